@@ -10,6 +10,9 @@
 
 #include "Image.h"
 
+#include <cstdio>
+#include <fstream>
+
 using namespace std;
 
 // --------- HANDOUT  PS07 ------------------------------
@@ -301,6 +304,89 @@ void Image::create_line(int xstart, int ystart, int xend, int yend,
 // ---------------- END of PS01 -------------------------------------
 
 
+// -------------- Grid views -------------------------
+
+bool Image::write(const GridView<const float> & view, const std::string & filename,
+                  float scale, bool flipY, const PngOptions & options) {
+    // greyscale samples, big endian when 16 bit as PNG stores them
+    int bytes = options.bitDepth == 16 ? 2 : 1;
+    std::vector<unsigned char> grey_image(view.height*view.width*bytes);
+    for (int y = 0; y < view.height; y++) {
+        const float * row = view.row(flipY ? view.height-1-y : y);
+        unsigned char * out = &grey_image[y*bytes*view.width];
+        if (bytes == 2) {
+            for (int x = 0; x < view.width; x++) {
+                unsigned short grey = float_to_uint16(row[x] * scale);
+                out[2*x + 0] = (unsigned char)(grey >> 8);
+                out[2*x + 1] = (unsigned char)(grey & 255);
+            }
+        } else {
+            for (int x = 0; x < view.width; x++) {
+                out[x] = float_to_uint8(row[x] * scale);
+            }
+        }
+    }
+
+    lodepng::State state;
+    state.info_raw.colortype = LCT_GREY;
+    state.info_raw.bitdepth = 8*bytes;
+    state.info_png.color.colortype = LCT_GREY;
+    state.info_png.color.bitdepth = 8*bytes;
+    state.encoder.auto_convert = 0;
+
+    LodePNGFilterStrategy filter = LFS_MINSUM;
+    switch (options.compression) {
+    case PngOptions::DEFAULT:
+        break;
+    case PngOptions::FAST:
+        state.encoder.zlibsettings.btype = 1;  // fixed Huffman codes
+        state.encoder.zlibsettings.windowsize = 256;
+        state.encoder.zlibsettings.nicematch = 32;
+        state.encoder.zlibsettings.lazymatching = 0;
+        break;
+    case PngOptions::STORE:
+        state.encoder.zlibsettings.btype = 0;
+        filter = LFS_ZERO;
+        break;
+    }
+    switch (options.filter) {
+    case PngOptions::AUTO: break;
+    case PngOptions::NONE: filter = LFS_ZERO; break;
+    case PngOptions::MINSUM: filter = LFS_MINSUM; break;
+    case PngOptions::ENTROPY: filter = LFS_ENTROPY; break;
+    }
+    state.encoder.filter_strategy = filter;
+
+    std::vector<unsigned char> png;
+    if (lodepng::encode(png, grey_image, view.width, view.height, state) != 0) return false;
+    // lodepng's save_file does not report a short write (a full disk)
+    FILE * file = fopen(filename.c_str(), "wb");
+    if (!file) return false;
+    bool ok = fwrite(png.data(), 1, png.size(), file) == png.size();
+    return fclose(file) == 0 && ok;
+}
+
+bool Image::writeRaw(const GridView<const float> & view, const std::string & filename,
+                     bool flipY) {
+    std::ofstream out(filename.c_str(), std::ios::binary);
+    for (int y = 0; y < view.height; y++) {
+        const float * row = view.row(flipY ? view.height-1-y : y);
+        out.write(reinterpret_cast<const char *>(row), view.width*sizeof(float));
+    }
+    out.close();
+    return !out.fail();
+}
+
+unsigned short Image::float_to_uint16(const float &in) {
+    float out = in;
+    if (out < 0)
+        out = 0;
+    if (out > 1)
+        out = 1;
+    return (unsigned short) (65535.0f*out + 0.5f);
+}
+
+
 
 
 /*********************************************************************
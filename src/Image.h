@@ -19,8 +19,32 @@
 #include <cmath>
 
 #include "ImageException.h"
+#include "grid2d.h"
 #include "lodepng.h"
 
+// How Image::write encodes a single channel grid as a PNG. Samples are
+// written as greyscale of bitDepth bits (8 or 16); 16 bits avoids the
+// terracing 8 bit heights show once rendered as a heightfield.
+//
+// The compression preset trades file size for encoder time: DEFAULT is
+// lodepng's own setting, FAST uses fixed Huffman codes and a short LZ77
+// window without lazy matching, and STORE writes uncompressed deflate
+// blocks. The filter strategy is normally left to the preset (AUTO),
+// which picks MINSUM for DEFAULT and FAST and no filtering for STORE.
+struct PngOptions {
+    enum Compression { DEFAULT, FAST, STORE };
+    enum Filter { AUTO, NONE, MINSUM, ENTROPY };
+
+    PngOptions(int bitDepth_ = 8, Compression compression_ = DEFAULT, Filter filter_ = AUTO) :
+        bitDepth(bitDepth_),
+        compression(compression_),
+        filter(filter_) {}
+
+    int bitDepth;
+    Compression compression;
+    Filter filter;
+};
+
 class Image {
 public:
     // Constructor to initialize an image of size width_*height_*channels_
@@ -52,6 +76,18 @@ public:
 
     // Write an image to a file.
     void write(const std::string & filename) const;
+    // Write a single channel grid to a file straight from its memory, without
+    // building an Image first. Values are multiplied by scale and stored as
+    // a greyscale PNG encoded as options asks, and flipY stores grid row 0
+    // as the bottom row of the file. Returns false if it cannot be written.
+    static bool write(const GridView<const float> & view, const std::string & filename,
+                      float scale = 1.0f, bool flipY = false,
+                      const PngOptions & options = PngOptions());
+    // Write a single channel grid as headerless float32 in native byte order,
+    // row by row and unscaled, so no precision is lost. Returns false if it
+    // cannot be written.
+    static bool writeRaw(const GridView<const float> & view, const std::string & filename,
+                         bool flipY = false);
     void debug_write() const; // Writes image to Output directory with automatically chosen name
     static int debugWriteNumber; // Image number for debug write
 
@@ -113,6 +149,7 @@ private:
     // Helper functions for reading and writing
     static float uint8_to_float(const unsigned char &in); // Converts uint8 to float, 255 -> 1, 0 -> 0
     static unsigned char float_to_uint8(const float &in); // Converts floats to uint8 0 -> 0, 1 -> 255
+    static unsigned short float_to_uint16(const float &in); // Converts floats to uint16 0 -> 0, 1 -> 65535
 
     // Common code shared between constructors
     // This does not allocate the image; it only initializes image metadata -
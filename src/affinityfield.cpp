@@ -0,0 +1,125 @@
+#include "affinityfield.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "Image.h"
+
+namespace
+{
+
+// integer hash of a lattice point, mapped to [0, 1)
+float latticeValue(int y, int x, uint32_t seed) {
+    uint32_t h = seed * 0x9E3779B9u ^ (uint32_t)x * 0x85EBCA6Bu ^ (uint32_t)y * 0xC2B2AE35u;
+    h ^= h >> 16;
+    h *= 0x7FEB352Du;
+    h ^= h >> 15;
+    h *= 0x846CA68Bu;
+    h ^= h >> 16;
+    return (h >> 8) * (1.f / 16777216.f);
+}
+
+float smooth(float t) {
+    return t * t * (3.f - 2.f * t);
+}
+
+}
+
+void AffinityField::window(int gy, int gx, int dir, int lookAhead, int gridSize,
+        int& y0, int& y1, int& x0, int& x1) {
+    int left = gx + (dir-1)*(lookAhead-1) - (lookAhead-1)/2;
+    y0 = max(min(gy - lookAhead + 1, gridSize-1), 0);
+    y1 = max(min(gy + 1, gridSize-1), 0);
+    x0 = max(min(left, gridSize-1), 0);
+    x1 = max(min(left + lookAhead, gridSize-1), 0);
+}
+
+void AffinityField::random(int gridSize, Random& rng) {
+    field.resize(gridSize, gridSize, 0.f);
+    for (int y=0; y<gridSize; ++y) {
+        rng.fill(field[y], gridSize, 0.f, 1.f);
+    }
+    lookAhead = 0;
+}
+
+void AffinityField::noise(int gridSize, uint32_t seed, float featureX, float featureY) {
+    field.resize(gridSize, gridSize, 0.f);
+    featureX = max(featureX, 1.f);
+    featureY = max(featureY, 1.f);
+    for (int y=0; y<gridSize; ++y) {
+        float fy = y / featureY;
+        int ly = (int)floor(fy);
+        float ty = smooth(fy - ly);
+        for (int x=0; x<gridSize; ++x) {
+            float fx = x / featureX;
+            int lx = (int)floor(fx);
+            float tx = smooth(fx - lx);
+            float bottom = latticeValue(ly, lx, seed) * (1.f - tx) + latticeValue(ly, lx+1, seed) * tx;
+            float top = latticeValue(ly+1, lx, seed) * (1.f - tx) + latticeValue(ly+1, lx+1, seed) * tx;
+            field[y][x] = bottom * (1.f - ty) + top * ty;
+        }
+    }
+    lookAhead = 0;
+}
+
+void AffinityField::load(const string& filename, int gridSize) {
+    Image image(filename);
+    int w = image.width(), h = image.height();
+
+    field.resize(gridSize, gridSize, 0.f);
+    for (int y=0; y<gridSize; ++y) {
+        // bilinear sample at the cell centre
+        float v = (gridSize - 1 - y + 0.5f) * h / gridSize - 0.5f;
+        int v0 = max(0, min(h-1, (int)floor(v)));
+        int v1 = min(h-1, v0+1);
+        float tv = max(0.f, min(1.f, v - v0));
+        for (int x=0; x<gridSize; ++x) {
+            float u = (x + 0.5f) * w / gridSize - 0.5f;
+            int u0 = max(0, min(w-1, (int)floor(u)));
+            int u1 = min(w-1, u0+1);
+            float tu = max(0.f, min(1.f, u - u0));
+
+            float sum = 0.f;
+            for (int c=0; c<3; ++c) {
+                float top = image(u0, v0, c) * (1.f - tu) + image(u1, v0, c) * tu;
+                float bottom = image(u0, v1, c) * (1.f - tu) + image(u1, v1, c) * tu;
+                sum += top * (1.f - tv) + bottom * tv;
+            }
+            field[y][x] = sum / 3.f;
+        }
+    }
+    lookAhead = 0;
+}
+
+void AffinityField::prepare(int lookAhead_) {
+    lookAhead = lookAhead_;
+    int n = size();
+    best.resize(n, n, -1);
+    for (int y=0; y<n; ++y) {
+        for (int x=0; x<n; ++x) {
+            best[y][x] = (int8_t)windowDirection(y, x);
+        }
+    }
+}
+
+int AffinityField::windowDirection(int gy, int gx) const {
+    // summed in the same order evalAccel used to, so ties and near ties
+    // resolve the same way (the first window strictly above the others)
+    int bestDir = -1;
+    float maxAffinity = 0.f;
+    for (int dir=0; dir<3; ++dir) {
+        int y0, y1, x0, x1;
+        window(gy, gx, dir, lookAhead, size(), y0, y1, x0, x1);
+        float affinity = 0.f;
+        for (int y=y0; y<y1; ++y) {
+            for (int x=x0; x<x1; ++x) {
+                affinity += field[y][x];
+            }
+        }
+        if (affinity > maxAffinity) {
+            maxAffinity = affinity;
+            bestDir = dir;
+        }
+    }
+    return bestDir;
+}
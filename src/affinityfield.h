@@ -0,0 +1,62 @@
+#ifndef AFFINITYFIELD_H
+#define AFFINITYFIELD_H
+
+#include <cstdint>
+#include <string>
+
+#include "grid2d.h"
+#include "random.h"
+
+using namespace std;
+
+// How strongly each cell of the glass attracts water, in [0, 1].
+//
+// The field never changes during a run. It can be generated as white
+// noise, as seeded value noise (anisotropic features make streaks), or
+// loaded from a texture. Once it is built, prepare() precomputes which
+// way a droplet with no water nearby is tugged from every cell, so that
+// evalAccel only needs one table read for it.
+class AffinityField {
+public:
+    // Constructor, Destructor
+    AffinityField() : lookAhead(0) {};
+    ~AffinityField() {};
+
+    // Static Helpers
+    // the tug windows of evalAccel: lookAhead x lookAhead cells below cell
+    // (gy, gx), shifted left (dir 0), centred (1) or right (2); the ends
+    // clamp to gridSize-1, so the last row/column is never included
+    static void window(int gy, int gx, int dir, int lookAhead, int gridSize,
+            int& y0, int& y1, int& x0, int& x1);
+
+    // Helper Observers
+    int size() const { return field.width(); }
+    float value(int y, int x) const { return field[y][x]; }
+    // window with the most affinity from cell (gy, gx), -1 if none has any
+    int bestDirection(int gy, int gx) const {
+        if (gy < 0 || gx < 0 || gy >= size() || gx >= size()) {
+            return windowDirection(gy, gx);
+        }
+        return best[gy][gx];
+    }
+
+    // State Mutators (each source replaces the field and needs a prepare)
+    // uniform white noise, drawn from rng a row at a time
+    void random(int gridSize, Random& rng);
+    // value noise from a seed; features are featureX x featureY cells
+    // (1 x 1 is white noise, tall and thin features look like streaks)
+    void noise(int gridSize, uint32_t seed, float featureX = 1.f, float featureY = 1.f);
+    // mean of the RGB channels, resampled to the grid, bottom image row at
+    // grid row 0 (the way heightmaps are written); throws like Image
+    void load(const string& filename, int gridSize);
+    void prepare(int lookAhead_);
+
+private:
+    int windowDirection(int gy, int gx) const;
+
+    Grid2D<float> field;
+    Grid2D<int8_t> best;            // bestDirection per cell
+    int lookAhead;                  // window size best was prepared for
+};
+
+#endif
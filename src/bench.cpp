@@ -0,0 +1,228 @@
+// Benchmarks of the WindowSystem step pipeline: a few fixed-seed
+// scenarios, each warmed up and then timed step by step and phase by
+// phase, with the results written as JSON to compare builds.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "random.h"
+#include "timestepper.h"
+#include "windowsystem.h"
+
+using namespace std;
+
+namespace
+{
+
+struct Scenario {
+    const char* name;
+    float granularity;
+    float raininess;
+    float massLo, massHi;           // rain droplet masses
+    int clusterEvery;               // steps between injected clusters, 0 = none
+    int clusterSize;                // droplets per cluster
+    int steps;                      // timed steps unless -n is given
+};
+
+const Scenario SCENARIOS[] = {
+    // name          gran     rain   masses      clusters    steps
+    { "drizzle",     0.01f,   0.02f, 0.f, 1.2f,  0,  0,      600 },
+    { "heavy_rain",  0.01f,   0.8f,  0.f, 1.2f,  0,  0,      600 },
+    { "merge_storm", 0.01f,   1.0f,  0.5f, 2.f,  50, 150,    600 },
+    { "fine_grid",   0.0025f, 0.1f,  0.f, 1.2f,  0,  0,      150 },
+};
+const int SCENARIO_COUNT = sizeof(SCENARIOS) / sizeof(SCENARIOS[0]);
+
+struct Stats {
+    double mean, median, p95, p99, max;
+};
+
+Stats summarize(vector<double> ms) {
+    Stats s = { 0.0, 0.0, 0.0, 0.0, 0.0 };
+    if (ms.empty()) return s;
+    sort(ms.begin(), ms.end());
+    // nearest rank
+    auto rank = [&](double q) { return ms[min(ms.size() - 1, (size_t)(q * ms.size()))]; };
+    for (double v : ms) s.mean += v;
+    s.mean /= ms.size();
+    s.median = rank(0.5);
+    s.p95 = rank(0.95);
+    s.p99 = rank(0.99);
+    s.max = ms.back();
+    return s;
+}
+
+void printStats(FILE* out, const Stats& s) {
+    fprintf(out, "{\"mean\": %.4f, \"median\": %.4f, \"p95\": %.4f, \"p99\": %.4f, \"max\": %.4f}",
+            s.mean, s.median, s.p95, s.p99, s.max);
+}
+
+void injectCluster(WindowSystem& system, Random& rng, const Scenario& sc) {
+    // a clump of overlapping droplets near the top, all merging at once
+    float size = system.gridCells() * sc.granularity;
+    float cx = rng.uniform(0.2f, 0.8f) * size;
+    float cy = rng.uniform(0.7f, 0.9f) * size;
+    for (int k=0; k<sc.clusterSize; ++k) {
+        Vector3f pos(cx + rng.uniform(-0.3f, 0.3f), cy + rng.uniform(-0.3f, 0.3f), 0.f);
+        system.addDroplet(rng.uniform(0.2f, 0.9f), pos, Vector3f::ZERO);
+    }
+}
+
+void usage(const char* prog)
+{
+    printf("Usage: %s [options] [scenario ...]\n", prog);
+    printf("       -n <steps>      timed steps per scenario (default per scenario)\n");
+    printf("       -w <steps>      warmup steps, not timed (default 100)\n");
+    printf("       -s <seed>       random seed (default 1)\n");
+    printf("       -h <timestep>   step size in seconds (default 0.01)\n");
+    printf("       -i <e|s|m|r|a|c> integrator (default r)\n");
+    printf("       -j <threads>    simulation threads, 0 = all cores (default 1)\n");
+    printf("       -o <json>       results file (default bench.json)\n");
+    printf("\n");
+    printf("Scenarios:");
+    for (int k=0; k<SCENARIO_COUNT; ++k) printf(" %s", SCENARIOS[k].name);
+    printf(" (default all)\n");
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    int steps = 0;
+    int warmup = 100;
+    unsigned long long seed = 1;
+    float h = 0.01f;
+    char integrator = 'r';
+    int threads = 1;
+    string output = "bench.json";
+    vector<const Scenario*> selected;
+
+    for (int i=1; i<argc; ++i) {
+        const char* flag = argv[i];
+        bool hasValue = i+1 < argc;
+        if (!strcmp(flag, "-n") && hasValue) steps = atoi(argv[++i]);
+        else if (!strcmp(flag, "-w") && hasValue) warmup = atoi(argv[++i]);
+        else if (!strcmp(flag, "-s") && hasValue) seed = strtoull(argv[++i], nullptr, 10);
+        else if (!strcmp(flag, "-h") && hasValue) h = (float)atof(argv[++i]);
+        else if (!strcmp(flag, "-i") && hasValue) integrator = argv[++i][0];
+        else if (!strcmp(flag, "-j") && hasValue) threads = atoi(argv[++i]);
+        else if (!strcmp(flag, "-o") && hasValue) output = argv[++i];
+        else {
+            const Scenario* found = nullptr;
+            for (int k=0; k<SCENARIO_COUNT; ++k) {
+                if (!strcmp(flag, SCENARIOS[k].name)) found = &SCENARIOS[k];
+            }
+            if (!found) {
+                usage(argv[0]);
+                return -1;
+            }
+            selected.push_back(found);
+        }
+    }
+    if (selected.empty()) {
+        for (int k=0; k<SCENARIO_COUNT; ++k) selected.push_back(&SCENARIOS[k]);
+    }
+#ifndef __OPTIMIZE__
+    printf("Warning: unoptimized build, configure with -DCMAKE_BUILD_TYPE=Release\n");
+#endif
+
+    FILE* out = fopen(output.c_str(), "w");
+    if (!out) {
+        printf("Cannot write %s\n", output.c_str());
+        return -1;
+    }
+    fprintf(out, "{\n  \"compiler\": \"%s\",\n", __VERSION__);
+#ifdef __OPTIMIZE__
+    fprintf(out, "  \"optimized\": true,\n");
+#else
+    fprintf(out, "  \"optimized\": false,\n");
+#endif
+    fprintf(out, "  \"seed\": %llu,\n  \"integrator\": \"%c\",\n  \"step_size\": %g,\n"
+            "  \"threads\": %d,\n  \"warmup\": %d,\n  \"scenarios\": [\n",
+            seed, integrator, h, threads, warmup);
+
+    for (size_t si=0; si<selected.size(); ++si) {
+        const Scenario& sc = *selected[si];
+        int timed = steps > 0 ? steps : sc.steps;
+
+        TimeStepper* timeStepper;
+        switch (integrator) {
+        case 'e': timeStepper = new ForwardEuler(); break;
+        case 's': timeStepper = new SemiImplicitEuler(); break;
+        case 'm': timeStepper = new Midpoint(); break;
+        case 'r': timeStepper = new RK4(); break;
+        case 'a': timeStepper = new RK45(); break;
+        case 'c': timeStepper = new CFLStepper(); break;
+        default: printf("Unrecognized integrator\n"); return -1;
+        }
+        WindowSystem system(Vector3f(-2.5f, -2.5f, 0.f), 5.0f, sc.granularity,
+                sc.raininess, vector<float>({sc.massLo, sc.massHi}));
+        system.setSeed(seed);
+        system.setThreadCount(threads);
+        ExportPolicy policy;
+        policy.sink = ExportPolicy::NONE;
+        policy.verbose = false;
+        system.setExportPolicy(policy);
+        // a stream per scenario, whichever scenarios run with it
+        Random clusterRng(seed, 1000 + (selected[si] - SCENARIOS));
+
+        Profiler& profiler = system.profiler();
+        profiler.setRecording(true);
+        vector<double> stepMs;
+        stepMs.reserve(timed);
+        double dropletSteps = 0.0;
+
+        printf("%-12s %d warmup + %d timed steps at granularity %g\n",
+                sc.name, warmup, timed, sc.granularity);
+        for (int k=0; k<warmup + timed; ++k) {
+            if (sc.clusterEvery > 0 && k % sc.clusterEvery == 0) {
+                injectCluster(system, clusterRng, sc);
+            }
+            if (k == warmup) profiler.setEnabled(true);
+            auto start = chrono::steady_clock::now();
+            {
+                PROFILE_SCOPE(profiler, Profiler::INTEGRATE);
+                timeStepper->takeStep(&system, h);
+            }
+            double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+            if (k >= warmup) {
+                stepMs.push_back(ms);
+                dropletSteps += system.dropletCount();
+            }
+        }
+
+        Stats step = summarize(stepMs);
+        double seconds = 0.0;
+        for (double ms : stepMs) seconds += ms * 1e-3;
+        printf("             step median %.3f ms, p95 %.3f ms, p99 %.3f ms, %.0f droplet steps/s\n",
+                step.median, step.p95, step.p99, seconds > 0.0 ? dropletSteps / seconds : 0.0);
+
+        fprintf(out, "    {\n      \"name\": \"%s\",\n      \"granularity\": %g,\n"
+                "      \"raininess\": %g,\n      \"steps\": %d,\n",
+                sc.name, sc.granularity, sc.raininess, timed);
+        fprintf(out, "      \"droplets_end\": %d,\n      \"droplets_mean\": %.1f,\n"
+                "      \"droplet_steps_per_s\": %.1f,\n      \"step_ms\": ",
+                system.dropletCount(), dropletSteps / max(1, timed),
+                seconds > 0.0 ? dropletSteps / seconds : 0.0);
+        printStats(out, step);
+        fprintf(out, ",\n      \"phase_ms\": {\n");
+        for (int p=0; p<Profiler::PHASE_COUNT; ++p) {
+            vector<double> ms(profiler.recordedSteps());
+            for (int k=0; k<profiler.recordedSteps(); ++k) ms[k] = profiler.recordedMs(k, p);
+            fprintf(out, "        \"%s\": ", Profiler::phaseName(p));
+            printStats(out, summarize(ms));
+            fprintf(out, "%s\n", p+1 < Profiler::PHASE_COUNT ? "," : "");
+        }
+        fprintf(out, "      }\n    }%s\n", si+1 < selected.size() ? "," : "");
+        delete timeStepper;
+    }
+    fprintf(out, "  ]\n}\n");
+    fclose(out);
+    printf("Results written to %s\n", output.c_str());
+    return 0;
+}
@@ -0,0 +1,94 @@
+#include "boxblur.h"
+
+#include <algorithm>
+
+#if defined(__SSE__) || defined(_M_X64)
+#include <xmmintrin.h>
+#define BOXBLUR_SSE
+#endif
+
+void BoxBlur::blurRow(const float * src, float * dst, int gridSize,
+        int x0, int x1, int radius) {
+    // running sum over the clamped window [x-r, x+r]
+    double sum = 0.0;
+    for (int k=-radius; k<=radius; ++k) {
+        sum += src[max(0, min(gridSize-1, x0+k))];
+    }
+    float norm = 1.f / (2*radius + 1);
+    for (int x=x0; x<x1; ++x) {
+        dst[x-x0] = (float)sum * norm;
+        sum += src[min(gridSize-1, x+radius+1)] - src[max(0, x-radius)];
+    }
+}
+
+void BoxBlur::blurBand(const GridView<float>& grid,
+        int y0, int y1, int x0, int x1,
+        int radius, float epsilon, TileMask& wet) {
+    int gridSize = grid.height;
+    int width = x1 - x0;
+    int ringRows = 2*radius + 2;
+    ring.resize(ringRows * width);
+    colSum.assign(width, 0.f);
+    tileWet.resize((width + TileMask::TILE_SIZE - 1) >> TileMask::TILE_SHIFT);
+
+    // prime the ring and the column sums with the window around y0
+    for (int y=max(0, y0-radius); y<=min(gridSize-1, y0+radius); ++y) {
+        blurRow(grid[y], &ring[(y % ringRows) * width], gridSize, x0, x1, radius);
+    }
+    for (int k=-radius; k<=radius; ++k) {
+        int yy = max(0, min(gridSize-1, y0+k));
+        const float * h = &ring[(yy % ringRows) * width];
+        for (int x=0; x<width; ++x) {
+            colSum[x] += h[x];
+        }
+    }
+
+    float norm = 1.f / (2*radius + 1);
+    fill(tileWet.begin(), tileWet.end(), 0);
+    for (int y=y0; y<y1; ++y) {
+        float * out = grid[y] + x0;
+        int next = y + radius + 1;
+
+        // blur the row entering the window before this row is overwritten
+        if (y+1 < y1 && next < gridSize) {
+            blurRow(grid[next], &ring[(next % ringRows) * width], gridSize, x0, x1, radius);
+        }
+        const float * add = &ring[(min(gridSize-1, next) % ringRows) * width];
+        const float * sub = &ring[(max(0, y-radius) % ringRows) * width];
+
+        int x = 0;
+#ifdef BOXBLUR_SSE
+        __m128 vNorm = _mm_set1_ps(norm);
+        __m128 vEps = _mm_set1_ps(epsilon);
+        for (; x+4<=width; x+=4) {
+            __m128 s = _mm_loadu_ps(&colSum[x]);
+            __m128 h = _mm_mul_ps(s, vNorm);
+            __m128 keep = _mm_cmpge_ps(h, vEps);
+            h = _mm_and_ps(h, keep);
+            _mm_storeu_ps(out + x, h);
+            if (_mm_movemask_ps(_mm_cmpneq_ps(h, _mm_setzero_ps()))) {
+                tileWet[x >> TileMask::TILE_SHIFT] = 1;
+            }
+            s = _mm_add_ps(s, _mm_sub_ps(_mm_loadu_ps(add + x), _mm_loadu_ps(sub + x)));
+            _mm_storeu_ps(&colSum[x], s);
+        }
+#endif
+        for (; x<width; ++x) {
+            float h = colSum[x] * norm;
+            h = h >= epsilon ? h : 0.f;
+            out[x] = h;
+            if (h != 0.f) tileWet[x >> TileMask::TILE_SHIFT] = 1;
+            colSum[x] += add[x] - sub[x];
+        }
+
+        // a tile row is finished, publish which of its tiles stayed wet
+        if (((y+1) & (TileMask::TILE_SIZE-1)) == 0 || y+1 == y1) {
+            int ty = y >> TileMask::TILE_SHIFT;
+            int tx0 = x0 >> TileMask::TILE_SHIFT;
+            for (int t=0; t<(int)tileWet.size(); ++t) {
+                wet.set(ty, tx0 + t, tileWet[t] != 0);
+            }
+            fill(tileWet.begin(), tileWet.end(), 0);
+        }
+    }
+}
@@ -0,0 +1,41 @@
+#ifndef BOXBLUR_H
+#define BOXBLUR_H
+
+#include <vector>
+
+#include "grid2d.h"
+#include "tilemask.h"
+
+using namespace std;
+
+// Separable (2r+1)x(2r+1) box blur with clamped edges, run in place.
+//
+// Each row is blurred horizontally with a running sum into a ring of 2r+2
+// rows, and a running column sum slides down the band, so the cost per
+// cell does not depend on the radius and no copy of the grid is needed.
+// The vertical pass, the epsilon threshold and the wet-tile test are fused
+// into one vectorized sweep.
+class BoxBlur {
+public:
+    // Constructor, Destructor
+    BoxBlur() {};
+    ~BoxBlur() {};
+
+    // Blurs cells [y0,y1) x [x0,x1) of a square grid. Cells outside the
+    // band are read but never written. Results below epsilon become zero,
+    // and wet is updated for every tile inside the band (the band must be
+    // tile aligned).
+    void blurBand(const GridView<float>& grid,
+            int y0, int y1, int x0, int x1,
+            int radius, float epsilon, TileMask& wet);
+
+private:
+    void blurRow(const float * src, float * dst, int gridSize,
+            int x0, int x1, int radius);
+
+    vector<float> ring;             // horizontally blurred rows, by y % size
+    vector<float> colSum;           // running vertical sum of the ring
+    vector<uint8_t> tileWet;        // any non-zero output per tile column
+};
+
+#endif
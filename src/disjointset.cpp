@@ -0,0 +1,69 @@
+#include "disjointset.h"
+
+#include <algorithm>
+
+void DisjointSet::reset(int n) {
+    // only the elements united since the last reset need restoring
+    for (int i : touched) {
+        parent[i] = i;
+        rank[i] = 0;
+    }
+    touched.clear();
+    for (int i=(int)parent.size(); i<n; ++i) {
+        parent.push_back(i);
+        rank.push_back(0);
+    }
+}
+
+int DisjointSet::find(int i) {
+    int root = i;
+    while (parent[root] != root) {
+        root = parent[root];
+    }
+    while (parent[i] != root) {
+        int next = parent[i];
+        parent[i] = root;
+        i = next;
+    }
+    return root;
+}
+
+void DisjointSet::unite(int i, int j) {
+    if (i == j) {
+        // a set of its own: grouped, though still a root
+        if (!grouped(i)) {
+            touched.push_back(i);
+            rank[i] = 1;
+        }
+        return;
+    }
+    if (!grouped(i)) touched.push_back(i);
+    if (!grouped(j)) touched.push_back(j);
+    int ri = find(i);
+    int rj = find(j);
+    if (ri == rj) return;
+    if (rank[ri] < rank[rj]) {
+        swap(ri, rj);
+    }
+    parent[rj] = ri;
+    if (rank[ri] == rank[rj]) {
+        ++rank[ri];
+    }
+}
+
+void DisjointSet::collect(vector<int>& members, vector<int>& offsets) {
+    members.clear();
+    offsets.clear();
+    scratch.clear();
+    for (int i : touched) {
+        scratch.push_back(make_pair(find(i), i));
+    }
+    sort(scratch.begin(), scratch.end());
+    for (int k=0; k<(int)scratch.size(); ++k) {
+        if (k == 0 || scratch[k].first != scratch[k-1].first) {
+            offsets.push_back(k);
+        }
+        members.push_back(scratch[k].second);
+    }
+    offsets.push_back((int)members.size());
+}
@@ -0,0 +1,41 @@
+#ifndef DISJOINTSET_H
+#define DISJOINTSET_H
+
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+// Union-find over the dense droplet slots of a single step, with path
+// compression and union by rank.
+//
+// Only the elements that take part in a union are recorded, so reset()
+// and collect() cost O(merged droplets) rather than O(droplets), and once
+// the internal buffers have grown to the working set no step allocates.
+class DisjointSet {
+public:
+    // Constructor, Destructor
+    DisjointSet() {};
+    ~DisjointSet() {};
+
+    // State Mutators
+    void reset(int n);
+    int find(int i);
+    void unite(int i, int j);       // unite(i, i) groups i on its own
+
+    // Helper Observers
+    bool empty() const { return touched.empty(); }
+    bool grouped(int i) const { return parent[i] != i || rank[i] != 0; }
+
+    // Lists every set that took part in a union: the members of set k
+    // are members[offsets[k]] .. members[offsets[k+1]-1].
+    void collect(vector<int>& members, vector<int>& offsets);
+
+private:
+    vector<int> parent;
+    vector<int> rank;
+    vector<int> touched;            // elements that have been united
+    vector<pair<int, int>> scratch; // (root, element) pairs for collect
+};
+
+#endif
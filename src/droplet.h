@@ -1,40 +1,57 @@
 #ifndef DROPLET_H
 #define DROPLET_H
 
-#include <vector>
 #include <vecmath.h>
 #include <cstdint>
 
+#include "random.h"
+#include "span.h"
+
 using namespace std;
 
+// Shape of a droplet: the chain of hemispheres it is rasterized as.
+// Kinematic state (position, velocity, mass, split timer) lives in the
+// DropletStore. The chain is stored inline, so a Droplet is a small
+// trivially copyable value and creating one allocates nothing.
 class Droplet {
 public:
     // Constructor, Destructor
-    Droplet(int idx_, float mass_, float granularity_);
+    // the chain shape is drawn from rng
+    Droplet(float mass_, Random& rng);
     ~Droplet() {};
 
     // Static Constants
     static const float MAX_SPLIT_TIME;
     static const float STATIC_MASS;
+    static const int MAX_CHAIN = 3;     // hemispheres in a moving droplet's chain
+    // steps a chain can take, in cells (x, y): right, down-right, down,
+    // down-left, left
+    static constexpr int OFFSET_DOMAIN[5][2] = {
+        {1, 0}, {1, -1}, {0, -1}, {-1, -1}, {-1, 0}
+    };
 
     // Static Helpers
-    const float radius(float m);
+    static float radius(float m);
+    static float splitProb(float splitTime, float stepSize);
+    // step k of OFFSET_DOMAIN on a grid of granularity-wide cells
+    static Vector3f offset(int k, float granularity) {
+        return Vector3f(OFFSET_DOMAIN[k][0] * granularity,
+                OFFSET_DOMAIN[k][1] * granularity, 0.f);
+    }
 
     // Helper Observers
-    float splitProb(float stepSize);
-    vector<Vector3f> getOffsetChain();
-    vector<float> getDist();
+    int chainLength() const { return length; }
+    Span<const uint8_t> offsetChain() const { return Span<const uint8_t>(chainIdx, length); }
+    Span<const float> dists() const { return Span<const float>(chainDist, length); }
 
     // Debug Helpers
-    void print();
+    void print(float granularity) const;
 
+private:
     // representation
-    int idx;
-    float mass;
-    vector<int> offset_chain_idx;
-    vector<Vector3f> OFFSET_DOMAIN;
-    vector<float> dist;
-    float split_time;
+    int length;
+    uint8_t chainIdx[MAX_CHAIN];        // OFFSET_DOMAIN index of each step
+    float chainDist[MAX_CHAIN];         // share of the mass at each step, sums to 1
 };
 
 #endif
@@ -0,0 +1,91 @@
+#include "dropletstore.h"
+
+DropletStore::DropletStore() {}
+
+bool DropletStore::contains(int h) const {
+    return h >= 0 && h < (int)slots.size() && slots[h] != -1 && !dead[slots[h]];
+}
+
+int DropletStore::add(float mass_, Vector3f pos_, Vector3f vel_, const Droplet& shape_) {
+    int h;
+    if (!freeHandles.empty()) {
+        h = freeHandles.back();
+        freeHandles.pop_back();
+        slots[h] = size();
+    } else {
+        h = (int)slots.size();
+        slots.push_back(size());
+    }
+    handle.push_back(h);
+    pos.push_back(pos_);
+    vel.push_back(vel_);
+    mass.push_back(mass_);
+    splitTime.push_back(0.f);
+    shape.push_back(shape_);
+    stillSteps.push_back(0);
+    asleep.push_back(0);
+    dead.push_back(0);
+    return h;
+}
+
+void DropletStore::kill(int h) {
+    int i = slots[h];
+    if (dead[i]) return;
+    dead[i] = 1;
+    killed.push_back(h);
+}
+
+void DropletStore::compact() {
+    if (killed.empty()) return;
+
+    // slide the live droplets down over the dead ones, in one pass
+    int n = size();
+    int j = 0;
+    for (int i=0; i<n; ++i) {
+        if (dead[i]) {
+            slots[handle[i]] = -1;
+            continue;
+        }
+        if (i != j) {
+            handle[j] = handle[i];
+            pos[j] = pos[i];
+            vel[j] = vel[i];
+            mass[j] = mass[i];
+            splitTime[j] = splitTime[i];
+            shape[j] = shape[i];
+            stillSteps[j] = stillSteps[i];
+            asleep[j] = asleep[i];
+            dead[j] = 0;
+            slots[handle[j]] = j;
+        }
+        ++j;
+    }
+    handle.resize(j);
+    pos.resize(j);
+    vel.resize(j);
+    mass.resize(j);
+    splitTime.resize(j);
+    shape.erase(shape.begin() + j, shape.end());   // Droplet has no default
+    stillSteps.resize(j);
+    asleep.resize(j);
+    dead.resize(j);
+
+    // handles are handed out again in the order they were killed
+    freeHandles.insert(freeHandles.end(), killed.rbegin(), killed.rend());
+    killed.clear();
+}
+
+void DropletStore::clear() {
+    handle.clear();
+    pos.clear();
+    vel.clear();
+    mass.clear();
+    splitTime.clear();
+    shape.clear();
+    stillSteps.clear();
+    asleep.clear();
+    dead.clear();
+    slots.clear();
+    freeHandles.clear();
+    killed.clear();
+}
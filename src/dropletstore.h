@@ -0,0 +1,58 @@
+#ifndef DROPLETSTORE_H
+#define DROPLETSTORE_H
+
+#include <vector>
+#include <vecmath.h>
+
+#include "droplet.h"
+
+using namespace std;
+
+// Dense structure-of-arrays storage for every live droplet.
+//
+// Droplets are addressed two ways:
+//  - a dense slot in [0, size()), which indexes the parallel arrays below
+//    and changes whenever the store is compacted, and
+//  - a stable handle, which never changes for the lifetime of the droplet
+//    and is what gets written into the idMap.
+//
+// Removal is deferred: kill only marks a droplet dead, so slots stay valid
+// for the rest of the step, and compact then drops every dead droplet in
+// one pass and frees their handles for reuse by later adds.
+class DropletStore {
+public:
+    // Constructor, Destructor
+    DropletStore();
+    ~DropletStore() {};
+
+    // Helper Observers
+    int size() const { return (int)handle.size(); }
+    bool empty() const { return handle.empty(); }
+    bool contains(int h) const;         // live and not killed
+    int slot(int h) const { return slots[h]; }
+    int deadCount() const { return (int)killed.size(); }
+
+    // State Mutators
+    int add(float mass_, Vector3f pos_, Vector3f vel_, const Droplet& shape_);
+    void kill(int h);                   // no-op if already killed
+    void compact();                     // keeps the order of live droplets
+    void clear();
+
+    // representation (parallel arrays indexed by dense slot)
+    vector<int> handle;
+    vector<Vector3f> pos;
+    vector<Vector3f> vel;
+    vector<float> mass;
+    vector<float> splitTime;
+    vector<Droplet> shape;
+    vector<int> stillSteps;         // consecutive steps spent nearly still
+    vector<char> asleep;            // frozen in place until woken
+    vector<char> dead;              // killed, gone at the next compact
+
+private:
+    vector<int> slots;              // handle -> dense slot, -1 when free
+    vector<int> freeHandles;        // released by compact, reused last in first out
+    vector<int> killed;             // handles killed since the last compact
+};
+
+#endif
@@ -0,0 +1,207 @@
+#include "exporter.h"
+
+#include <algorithm>
+#include <cstdio>
+
+HeightMapExporter::HeightMapExporter(int encoders_, int slots_, Backpressure policy_) :
+    policy(policy_),
+    readyHead(0),
+    readyCount(0),
+    encoding(0),
+    paused(false),
+    tickets(0),
+    nextAppend(0),
+    submittedFrames(0),
+    writtenFrames(0),
+    droppedFrames(0),
+    failedFrames(0),
+    stopping(false) {
+
+    slots_ = max(1, slots_);
+    slots.resize(slots_);
+    ready.resize(slots_);
+    for (int i=slots_-1; i>=0; --i) {
+        freeSlots.push_back(i);
+    }
+    for (int i=0; i<max(1, encoders_); ++i) {
+        encoders.push_back(thread(&HeightMapExporter::encoderLoop, this));
+    }
+}
+
+HeightMapExporter::~HeightMapExporter() {
+    {
+        lock_guard<mutex> guard(lock);
+        stopping = true;
+    }
+    frameReady.notify_all();
+    for (thread& t : encoders) {
+        t.join();
+    }
+}
+
+bool HeightMapExporter::submit(const GridView<const float>& heights, const string& filename,
+        float scale, bool flipY, Format format, const PngOptions& png) {
+    int s = acquireSlot();
+    if (s < 0) return false;
+
+    // copy the snapshot outside the lock; the slot is ours until queued
+    Slot& slot = slots[s];
+    fillSlot(slot, heights);
+    slot.filename = filename;
+    slot.scale = scale;
+    slot.flipY = flipY;
+    slot.format = format;
+    slot.png = png;
+    slot.sequence = nullptr;
+    queueSlot(s);
+    return true;
+}
+
+bool HeightMapExporter::append(const GridView<const float>& heights,
+        HeightSequenceWriter& sequence, double time) {
+    int s = acquireSlot();
+    if (s < 0) return false;
+
+    Slot& slot = slots[s];
+    fillSlot(slot, heights);
+    slot.sequence = &sequence;
+    slot.time = time;
+    slot.delta = false;
+    queueSlot(s);
+    return true;
+}
+
+bool HeightMapExporter::appendDelta(vector<unsigned char>& packed,
+        HeightSequenceWriter& sequence, double time) {
+    int s = acquireSlot();
+    if (s < 0) return false;
+
+    Slot& slot = slots[s];
+    slot.packedDelta.swap(packed);
+    slot.sequence = &sequence;
+    slot.time = time;
+    slot.delta = true;
+    queueSlot(s);
+    return true;
+}
+
+void HeightMapExporter::flush() {
+    unique_lock<mutex> guard(lock);
+    slotFreed.wait(guard, [this] { return readyCount == 0 && encoding == 0; });
+}
+
+void HeightMapExporter::setPaused(bool paused_) {
+    {
+        lock_guard<mutex> guard(lock);
+        paused = paused_;
+    }
+    frameReady.notify_all();
+}
+
+int HeightMapExporter::submitted() const {
+    lock_guard<mutex> guard(lock);
+    return submittedFrames;
+}
+
+int HeightMapExporter::written() const {
+    lock_guard<mutex> guard(lock);
+    return writtenFrames;
+}
+
+int HeightMapExporter::dropped() const {
+    lock_guard<mutex> guard(lock);
+    return droppedFrames;
+}
+
+int HeightMapExporter::failed() const {
+    lock_guard<mutex> guard(lock);
+    return failedFrames;
+}
+
+int HeightMapExporter::acquireSlot() {
+    unique_lock<mutex> guard(lock);
+    ++submittedFrames;
+    if (freeSlots.empty()) {
+        if (policy == DROP) {
+            ++droppedFrames;
+            return -1;
+        }
+        slotFreed.wait(guard, [this] { return !freeSlots.empty(); });
+    }
+    int s = freeSlots.back();
+    freeSlots.pop_back();
+    return s;
+}
+
+void HeightMapExporter::fillSlot(Slot& slot, const GridView<const float>& heights) {
+    if (slot.heights.width() != heights.width || slot.heights.height() != heights.height) {
+        slot.heights.resize(heights.width, heights.height);
+    }
+    for (int y=0; y<heights.height; ++y) {
+        copy(heights.row(y), heights.row(y) + heights.width, slot.heights[y]);
+    }
+}
+
+void HeightMapExporter::queueSlot(int s) {
+    {
+        lock_guard<mutex> guard(lock);
+        if (slots[s].sequence) {
+            // tickets follow the ready ring, so the lowest outstanding
+            // ticket is always held by an encoder that can go ahead
+            slots[s].ticket = tickets++;
+        }
+        ready[(readyHead + readyCount) % ready.size()] = s;
+        ++readyCount;
+    }
+    frameReady.notify_one();
+}
+
+void HeightMapExporter::encoderLoop() {
+    while (true) {
+        int s;
+        {
+            unique_lock<mutex> guard(lock);
+            frameReady.wait(guard, [this] { return stopping || (readyCount > 0 && !paused); });
+            // drain the queue before honouring a shutdown
+            if (readyCount == 0) return;
+            s = ready[readyHead];
+            readyHead = (readyHead + 1) % ready.size();
+            --readyCount;
+            ++encoding;
+        }
+
+        Slot& slot = slots[s];
+        bool ok;
+        if (slot.sequence) {
+            if (slot.delta) {
+                HeightSequence::deflateDelta(slot.packedDelta, slot.packed);
+            } else {
+                HeightSequence::encode(slot.heights.view(), slot.sequence->encoding(), slot.packed);
+            }
+            {
+                unique_lock<mutex> turn(appendLock);
+                appendTurn.wait(turn, [this, &slot] { return nextAppend == slot.ticket; });
+                ok = slot.sequence->appendEncoded(slot.packed, slot.time);
+                ++nextAppend;
+            }
+            appendTurn.notify_all();
+        } else if (slot.format == RAW) {
+            ok = Image::writeRaw(slot.heights.view(), slot.filename, slot.flipY);
+        } else {
+            ok = Image::write(slot.heights.view(), slot.filename, slot.scale, slot.flipY, slot.png);
+        }
+
+        {
+            lock_guard<mutex> guard(lock);
+            --encoding;
+            if (ok) {
+                ++writtenFrames;
+            } else if (failedFrames++ == 0) {
+                fprintf(stderr, "Cannot write %s; later failures are only counted\n",
+                        slot.sequence ? slot.sequence->filename().c_str() : slot.filename.c_str());
+            }
+            freeSlots.push_back(s);
+        }
+        slotFreed.notify_all();
+    }
+}
@@ -0,0 +1,119 @@
+#ifndef EXPORTER_H
+#define EXPORTER_H
+
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Image.h"
+#include "grid2d.h"
+#include "heightsequence.h"
+
+using namespace std;
+
+// Bounded producer/consumer queue that writes heightmap frames on a pool
+// of encoder threads, off the simulation thread.
+//
+// The queue owns a fixed ring of snapshot buffers (three by default, i.e.
+// triple buffering); submit() copies the grid into a free one and returns
+// straight away, so steady-state submits never allocate. When every
+// buffer is still waiting to be encoded, the backpressure policy decides
+// whether submit() waits for an encoder or drops the frame.
+//
+// Frames bound for a sequence file are encoded in parallel too, but
+// appended strictly in the order they were queued.
+//
+// A frame that cannot be written (a full disk, a missing directory) is
+// counted in failed(); the first failure is also reported on stderr.
+class HeightMapExporter {
+public:
+    enum Backpressure { BLOCK, DROP };
+    enum Format {
+        PNG,                        // greyscale PNG, scaled, as png asks
+        RAW                         // unscaled float32, see Image::writeRaw
+    };
+
+    // Constructor, Destructor
+    HeightMapExporter(int encoders = 2, int slots = 3, Backpressure policy_ = BLOCK);
+    ~HeightMapExporter();           // writes everything still queued
+
+    // State Mutators
+    // Queues heights to be written to filename in the given format (PNG
+    // values scaled by scale, row 0 at the bottom when flipY). Returns
+    // false if dropped.
+    bool submit(const GridView<const float>& heights, const string& filename,
+            float scale = 1.f, bool flipY = false,
+            Format format = PNG, const PngOptions& png = PngOptions());
+    // Queues heights to be appended to sequence, which must outlive the
+    // queue or a flush(). Returns false if dropped.
+    bool append(const GridView<const float>& heights, HeightSequenceWriter& sequence,
+            double time);
+    // Queues a TILE_DELTA delta frame from HeightSequence::packDelta, to be
+    // deflated and appended. Takes packed's contents, leaving it with a
+    // spare buffer. Returns false if dropped (packed is left alone).
+    bool appendDelta(vector<unsigned char>& packed, HeightSequenceWriter& sequence,
+            double time);
+    void flush();                   // waits until the queue is empty
+
+    // Helper Observers
+    int submitted() const;
+    int written() const;
+    int dropped() const;
+    int failed() const;             // frames that could not be written
+
+private:
+    // tests/sequence.cpp pauses the encoders to force a dropped frame
+    friend struct SequenceTestHook;
+
+    struct Slot {
+        Grid2D<float> heights;
+        string filename;
+        float scale;
+        bool flipY;
+        Format format;
+        PngOptions png;
+        HeightSequenceWriter* sequence; // appended to instead, if set
+        double time;
+        long long ticket;           // append order
+        bool delta;                 // packedDelta holds the frame, not heights
+        vector<unsigned char> packedDelta;
+        vector<unsigned char> packed;   // the payload appended
+    };
+
+    int acquireSlot();              // -1 if the frame is dropped
+    void fillSlot(Slot& slot, const GridView<const float>& heights);
+    void queueSlot(int s);
+    // while paused, queued frames wait for a resume rather than an
+    // encoder (so does flush()); a full queue then blocks or drops
+    void setPaused(bool paused_);
+    void encoderLoop();
+
+    Backpressure policy;
+    vector<Slot> slots;
+    vector<int> freeSlots;          // stack of slots ready for submit()
+    vector<int> ready;              // ring of slots waiting for an encoder
+    int readyHead;
+    int readyCount;
+    int encoding;                   // slots currently being encoded
+    bool paused;                    // encoders leave the ready ring alone
+
+    long long tickets;              // sequence frames queued
+    long long nextAppend;           // ticket whose turn it is to append
+    mutex appendLock;
+    condition_variable appendTurn;
+
+    int submittedFrames;
+    int writtenFrames;
+    int droppedFrames;
+    int failedFrames;
+
+    mutable mutex lock;
+    condition_variable slotFreed;   // signalled when an encoder is done
+    condition_variable frameReady;  // signalled on submit and shutdown
+    bool stopping;
+    vector<thread> encoders;
+};
+
+#endif
@@ -0,0 +1,17 @@
+#include "exportpolicy.h"
+
+#include <iomanip>
+#include <sstream>
+
+string ExportPolicy::filename(int frame) const {
+    ostringstream fname;
+    fname << directory << "/" << prefix;
+    fname << setfill('0') << setw(digits);
+    fname << frame;
+    fname << (sink == RAW ? ".raw" : ".png");
+    return fname.str();
+}
+
+string ExportPolicy::sequenceFilename() const {
+    return directory + "/" + prefix + ".a3seq";
+}
@@ -0,0 +1,55 @@
+#ifndef EXPORTPOLICY_H
+#define EXPORTPOLICY_H
+
+#include <string>
+
+#include "Image.h"
+#include "heightsequence.h"
+
+using namespace std;
+
+// When, where and whether WindowSystem writes heightmap frames.
+//
+// Frames go out either every `everySteps` simulation steps or, when fps is
+// positive, whenever the simulated clock crosses the next 1/fps boundary,
+// regardless of the step size. Output frames are numbered consecutively
+// from 1 and written to directory/prefix<number>.png (.raw for raw float
+// frames), with the number zero padded to at least `digits` digits. The
+// SEQUENCE sink appends them all to directory/prefix.a3seq instead.
+struct ExportPolicy {
+    enum Sink {
+        PNG,                        // encode frames through the export queue
+        RAW,                        // dump unscaled float32 frames instead
+        SEQUENCE,                   // append to one sequence file
+        NONE                        // drop frames (e.g. for benchmarking)
+    };
+
+    ExportPolicy() :
+        sink(PNG),
+        everySteps(1),
+        fps(0.f),
+        directory("../Output"),
+        prefix("heightmap"),
+        digits(4),
+        verbose(true),
+        sequenceEncoding(HeightSequence::DELTA_LZ),
+        keyEvery(30) {}
+
+    // Helper Observers
+    string filename(int frame) const;
+    string sequenceFilename() const;
+
+    // representation
+    Sink sink;
+    int everySteps;                 // export cadence in steps (when fps <= 0)
+    float fps;                      // export cadence in simulated frames/s
+    string directory;
+    string prefix;
+    int digits;
+    bool verbose;                   // print every filename as it is queued
+    PngOptions png;                 // bit depth and compression of PNG frames
+    HeightSequence::Encoding sequenceEncoding;
+    int keyEvery;                   // TILE_DELTA frames per keyframe
+};
+
+#endif
@@ -0,0 +1,117 @@
+#ifndef GRID2D_H
+#define GRID2D_H
+
+#include <algorithm>
+#include <cstdlib>
+#include <new>
+#include <vector>
+
+using namespace std;
+
+// Allocator handing out ALIGN-byte aligned blocks, so every row of a
+// Grid2D starts on a cache line (and a SIMD register boundary).
+template <typename T, size_t ALIGN>
+struct AlignedAllocator {
+    typedef T value_type;
+    template <typename U> struct rebind { typedef AlignedAllocator<U, ALIGN> other; };
+
+    AlignedAllocator() {}
+    template <typename U> AlignedAllocator(const AlignedAllocator<U, ALIGN>&) {}
+
+    T * allocate(size_t n) {
+        void * p = nullptr;
+#ifdef _MSC_VER
+        p = _aligned_malloc(n * sizeof(T), ALIGN);
+        if (!p) throw bad_alloc();
+#else
+        if (posix_memalign(&p, ALIGN, n * sizeof(T)) != 0) throw bad_alloc();
+#endif
+        return (T *)p;
+    }
+    void deallocate(T * p, size_t) {
+#ifdef _MSC_VER
+        _aligned_free(p);
+#else
+        free(p);
+#endif
+    }
+};
+
+template <typename T, typename U, size_t ALIGN>
+bool operator==(const AlignedAllocator<T, ALIGN>&, const AlignedAllocator<U, ALIGN>&) { return true; }
+template <typename T, typename U, size_t ALIGN>
+bool operator!=(const AlignedAllocator<T, ALIGN>&, const AlignedAllocator<U, ALIGN>&) { return false; }
+
+// Non-owning window onto a Grid2D (or any row-strided buffer).
+// Rows are stride elements apart; nothing is bounds checked.
+template <typename T>
+struct GridView {
+    T * data;
+    int width;
+    int height;
+    int stride;
+
+    GridView() : data(nullptr), width(0), height(0), stride(0) {}
+    GridView(T * data_, int width_, int height_, int stride_) :
+        data(data_), width(width_), height(height_), stride(stride_) {}
+    // a view of T converts to a view of const T
+    template <typename U>
+    GridView(const GridView<U>& v) : data(v.data), width(v.width), height(v.height), stride(v.stride) {}
+
+    T * row(int y) const { return data + (size_t)y * stride; }
+    T * operator[](int y) const { return row(y); }
+};
+
+// Dense 2D grid stored in one 64-byte aligned block, rows padded to a
+// multiple of 64 bytes. Indexed as grid[y][x] with no bounds checks.
+template <typename T>
+class Grid2D {
+public:
+    static const size_t ALIGNMENT = 64;
+
+    // Constructor, Destructor
+    Grid2D() : w(0), h(0), stride(0) {}
+    Grid2D(int width_, int height_, T value = T()) : w(0), h(0), stride(0) {
+        resize(width_, height_, value);
+    }
+    ~Grid2D() {}
+
+    // Helper Observers
+    int width() const { return w; }
+    int height() const { return h; }
+    int rowStride() const { return stride; }
+    bool empty() const { return w == 0 || h == 0; }
+
+    T * row(int y) { return cells.data() + (size_t)y * stride; }
+    const T * row(int y) const { return cells.data() + (size_t)y * stride; }
+    T * operator[](int y) { return row(y); }
+    const T * operator[](int y) const { return row(y); }
+
+    GridView<T> view() { return GridView<T>(row(0), w, h, stride); }
+    GridView<const T> view() const { return GridView<const T>(row(0), w, h, stride); }
+
+    // State Mutators
+    // Keeps the existing block whenever it is large enough.
+    void resize(int width_, int height_, T value = T()) {
+        w = width_;
+        h = height_;
+        stride = paddedStride(w);
+        cells.assign((size_t)stride * h, value);
+    }
+    void fill(T value) { std::fill(cells.begin(), cells.end(), value); }
+    void clear() { fill(T()); }
+
+private:
+    static int paddedStride(int width_) {
+        if (ALIGNMENT % sizeof(T) != 0) return width_;
+        int perLine = (int)(ALIGNMENT / sizeof(T));
+        return (width_ + perLine - 1) / perLine * perLine;
+    }
+
+    int w;
+    int h;
+    int stride;                     // elements between consecutive rows
+    vector<T, AlignedAllocator<T, ALIGNMENT>> cells;
+};
+
+#endif
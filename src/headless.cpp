@@ -0,0 +1,267 @@
+// Batch simulation without a window or an OpenGL context: runs
+// WindowSystem as fast as possible and writes the heightmap sequence.
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <string>
+
+#include "timestepper.h"
+#include "windowsystem.h"
+
+using namespace std;
+
+namespace
+{
+
+void usage(const char* prog)
+{
+    printf("Usage: %s [options]\n", prog);
+    printf("       -n <steps>      number of steps to simulate (default 1000)\n");
+    printf("       -d <seconds>    simulated duration, overrides -n\n");
+    printf("       -h <timestep>   step size in seconds (default 0.01)\n");
+    printf("       -i <e|s|m|r|a|c> integrator: Forward Euler, Semi-implicit Euler,\n");
+    printf("                       Midpoint, RK 4 (default), adaptive RK 45 or\n");
+    printf("                       RK 4 with fast droplets sub-stepped\n");
+    printf("       -l <cells>      with -i c, sub-step droplets moving more than\n");
+    printf("                       this many cells per step (default 0.5)\n");
+    printf("       -j <threads>    simulation threads, 0 = all cores (default)\n");
+    printf("       -o <dir>        output directory (default ../Output)\n");
+    printf("       -e <steps>      export every N steps (default 1)\n");
+    printf("       -f <fps>        export at a simulated frame rate instead\n");
+    printf("       -w <digits>     frame number width (default 4)\n");
+    printf("       -x              do not export frames\n");
+    printf("       -b <8|16>       PNG bits per height sample (default 8)\n");
+    printf("       -z <d|f|s>      PNG compression: lodepng default, fast, or\n");
+    printf("                       store only, uncompressed (default d)\n");
+    printf("       -Z <a|n|m|e>    PNG filter: as the compression picks, none,\n");
+    printf("                       minimum sum or entropy (default a)\n");
+    printf("       -R              write unscaled float32 .raw frames, not PNG\n");
+    printf("       -Q <f|h|d|t>    append every frame to <dir>/heightmap.a3seq as\n");
+    printf("                       float32, float16, lossless delta + deflate, or\n");
+    printf("                       keyframes and the tiles changed in between\n");
+    printf("                       (a3_seqconvert turns it into PNG frames)\n");
+    printf("       -K <frames>     with -Q t, frames per keyframe (default 30)\n");
+    printf("       -E <encoders>   PNG encoder threads (default 2)\n");
+    printf("       -D              drop frames instead of waiting for encoders\n");
+    printf("       -q              do not print every filename\n");
+    printf("       -r <rain>       raininess, spawn probability per step (default 0.05)\n");
+    printf("       -g <cell>       grid granularity (default 0.01)\n");
+    printf("       -s <seed>       random seed, to replay a run (default the time)\n");
+    printf("       -A <png>        load the glass affinity from a texture\n");
+    printf("       -N <seed>       seeded noise affinity instead of white noise\n");
+    printf("       -F <w>,<h>      noise feature size in cells (default 1,1)\n");
+    printf("       -p <steps>      profile the step phases, printing a summary\n");
+    printf("                       every N steps (0 = only at the end)\n");
+    printf("       -c <csv>        profile, writing every step's phase times\n");
+    printf("       -J <json>       profile, writing totals and means\n");
+    printf("       -t <json>       profile, writing a Chrome trace (chrome://tracing)\n");
+    printf("\n");
+    printf("Try  : %s -n 3500 -o ../Output\n", prog);
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    int steps = 1000;
+    double duration = 0.0;
+    float h = 0.01f;
+    char integrator = 'r';
+    int threads = 0;
+    int encoders = 2;
+    HeightMapExporter::Backpressure backpressure = HeightMapExporter::BLOCK;
+    float raininess = 0.05f;
+    float granularity = 0.01f;
+    float substepLimit = 0.5f;
+    const char* affinityFile = nullptr;
+    bool affinityNoise = false;
+    unsigned affinitySeed = 0;
+    float featureX = 1.f, featureY = 1.f;
+    bool seeded = false;
+    bool profile = false;
+    int summaryEvery = 0;
+    const char* csvFile = nullptr;
+    const char* jsonFile = nullptr;
+    const char* traceFile = nullptr;
+    unsigned long long seed = 0;
+    ExportPolicy policy;
+
+    for (int i=1; i<argc; ++i) {
+        const char* flag = argv[i];
+        bool hasValue = i+1 < argc;
+        if (!strcmp(flag, "-n") && hasValue) steps = atoi(argv[++i]);
+        else if (!strcmp(flag, "-d") && hasValue) duration = atof(argv[++i]);
+        else if (!strcmp(flag, "-h") && hasValue) h = (float)atof(argv[++i]);
+        else if (!strcmp(flag, "-i") && hasValue) integrator = argv[++i][0];
+        else if (!strcmp(flag, "-j") && hasValue) threads = atoi(argv[++i]);
+        else if (!strcmp(flag, "-o") && hasValue) policy.directory = argv[++i];
+        else if (!strcmp(flag, "-e") && hasValue) policy.everySteps = atoi(argv[++i]);
+        else if (!strcmp(flag, "-f") && hasValue) policy.fps = (float)atof(argv[++i]);
+        else if (!strcmp(flag, "-w") && hasValue) policy.digits = atoi(argv[++i]);
+        else if (!strcmp(flag, "-x")) policy.sink = ExportPolicy::NONE;
+        else if (!strcmp(flag, "-R")) policy.sink = ExportPolicy::RAW;
+        else if (!strcmp(flag, "-K") && hasValue) policy.keyEvery = atoi(argv[++i]);
+        else if (!strcmp(flag, "-Q") && hasValue) {
+            policy.sink = ExportPolicy::SEQUENCE;
+            switch (argv[++i][0]) {
+            case 'f': policy.sequenceEncoding = HeightSequence::FLOAT32; break;
+            case 'h': policy.sequenceEncoding = HeightSequence::FLOAT16; break;
+            case 'd': policy.sequenceEncoding = HeightSequence::DELTA_LZ; break;
+            case 't': policy.sequenceEncoding = HeightSequence::TILE_DELTA; break;
+            default: usage(argv[0]); return -1;
+            }
+        }
+        else if (!strcmp(flag, "-b") && hasValue) {
+            policy.png.bitDepth = atoi(argv[++i]);
+            if (policy.png.bitDepth != 8 && policy.png.bitDepth != 16) {
+                usage(argv[0]);
+                return -1;
+            }
+        }
+        else if (!strcmp(flag, "-z") && hasValue) {
+            switch (argv[++i][0]) {
+            case 'd': policy.png.compression = PngOptions::DEFAULT; break;
+            case 'f': policy.png.compression = PngOptions::FAST; break;
+            case 's': policy.png.compression = PngOptions::STORE; break;
+            default: usage(argv[0]); return -1;
+            }
+        }
+        else if (!strcmp(flag, "-Z") && hasValue) {
+            switch (argv[++i][0]) {
+            case 'a': policy.png.filter = PngOptions::AUTO; break;
+            case 'n': policy.png.filter = PngOptions::NONE; break;
+            case 'm': policy.png.filter = PngOptions::MINSUM; break;
+            case 'e': policy.png.filter = PngOptions::ENTROPY; break;
+            default: usage(argv[0]); return -1;
+            }
+        }
+        else if (!strcmp(flag, "-E") && hasValue) encoders = atoi(argv[++i]);
+        else if (!strcmp(flag, "-D")) backpressure = HeightMapExporter::DROP;
+        else if (!strcmp(flag, "-q")) policy.verbose = false;
+        else if (!strcmp(flag, "-r") && hasValue) raininess = (float)atof(argv[++i]);
+        else if (!strcmp(flag, "-g") && hasValue) granularity = (float)atof(argv[++i]);
+        else if (!strcmp(flag, "-s") && hasValue) {
+            seeded = true;
+            seed = strtoull(argv[++i], nullptr, 10);
+        }
+        else if (!strcmp(flag, "-p") && hasValue) {
+            profile = true;
+            summaryEvery = atoi(argv[++i]);
+        }
+        else if (!strcmp(flag, "-c") && hasValue) csvFile = argv[++i];
+        else if (!strcmp(flag, "-J") && hasValue) jsonFile = argv[++i];
+        else if (!strcmp(flag, "-t") && hasValue) traceFile = argv[++i];
+        else if (!strcmp(flag, "-l") && hasValue) substepLimit = (float)atof(argv[++i]);
+        else if (!strcmp(flag, "-A") && hasValue) affinityFile = argv[++i];
+        else if (!strcmp(flag, "-N") && hasValue) {
+            affinityNoise = true;
+            affinitySeed = (unsigned)strtoul(argv[++i], nullptr, 10);
+        }
+        else if (!strcmp(flag, "-F") && hasValue) {
+            if (sscanf(argv[++i], "%f,%f", &featureX, &featureY) != 2) {
+                usage(argv[0]);
+                return -1;
+            }
+        }
+        else {
+            usage(argv[0]);
+            return -1;
+        }
+    }
+    if (h <= 0.f) {
+        printf("Time step must be positive\n");
+        return -1;
+    }
+    if (duration > 0.0) {
+        steps = (int)ceil(duration / h - 1e-6);
+    }
+
+    TimeStepper* timeStepper;
+    switch (integrator) {
+    case 'e': timeStepper = new ForwardEuler(); break;
+    case 's': timeStepper = new SemiImplicitEuler(); break;
+    case 'm': timeStepper = new Midpoint(); break;
+    case 'r': timeStepper = new RK4(); break;
+    case 'a': timeStepper = new RK45(); break;
+    case 'c': timeStepper = new CFLStepper(); break;
+    default: printf("Unrecognized integrator\n"); return -1;
+    }
+
+    WindowSystem* windowSystem = new WindowSystem(
+            Vector3f(-2.5f, -2.5f, 0.f), 5.0f, granularity, raininess);
+    if (seeded) {
+        windowSystem->setSeed(seed);
+    }
+    windowSystem->setThreadCount(threads);
+    windowSystem->setSubstepLimit(substepLimit);
+    if (affinityFile || affinityNoise) {
+        AffinityField field;
+        try {
+            if (affinityFile) {
+                field.load(affinityFile, windowSystem->gridCells());
+            } else {
+                field.noise(windowSystem->gridCells(), affinitySeed, featureX, featureY);
+            }
+        } catch (const exception& e) {
+            if (affinityFile) {
+                printf("Cannot load affinity %s: %s\n", affinityFile, e.what());
+            } else {
+                printf("Cannot make noise affinity with seed %u: %s\n", affinitySeed, e.what());
+            }
+            return -1;
+        }
+        windowSystem->setAffinity(field);
+    }
+    Profiler& profiler = windowSystem->profiler();
+    profile = profile || csvFile || jsonFile || traceFile;
+    profiler.setEnabled(profile);
+    profiler.setSummaryEvery(summaryEvery);
+    profiler.setRecording(csvFile != nullptr);
+    profiler.setTracing(traceFile != nullptr);
+    windowSystem->setExportQueue(encoders, 3, backpressure);
+    try {
+        windowSystem->setExportPolicy(policy);
+    } catch (const exception& e) {
+        printf("%s\n", e.what());
+        return -1;
+    }
+
+    printf("Simulating %d steps of %.4fs with integrator %c, seed %llu\n", steps, h, integrator,
+            (unsigned long long)windowSystem->seed());
+    auto start = chrono::steady_clock::now();
+    for (int i=0; i<steps; ++i) {
+        PROFILE_SCOPE(profiler, Profiler::INTEGRATE);
+        timeStepper->takeStep(windowSystem, h);
+    }
+    double simulated_wall = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    windowSystem->flushExports();
+    double total_wall = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    const HeightMapExporter& exports = windowSystem->exportQueue();
+    printf("\n");
+    printf("steps           %d (%.3f simulated s)\n", steps, steps * h);
+    printf("droplets        %d at the end, %d asleep\n",
+            windowSystem->dropletCount(), windowSystem->sleepingCount());
+    printf("wall time       %.3f s (%.3f s stepping, %.3f s draining exports)\n",
+            total_wall, simulated_wall, total_wall - simulated_wall);
+    printf("throughput      %.1f steps/s, %.2f simulated s per wall s\n",
+            steps / total_wall, steps * h / total_wall);
+    printf("frames          %d written, %d dropped, %d failed\n", exports.written(),
+            exports.dropped(), exports.failed());
+
+    if (profile) {
+        printf("\n");
+        profiler.printSummary(stdout, true);
+        if (csvFile && !profiler.writeCsv(csvFile)) printf("Cannot write %s\n", csvFile);
+        if (jsonFile && !profiler.writeJson(jsonFile)) printf("Cannot write %s\n", jsonFile);
+        if (traceFile && !profiler.writeTrace(traceFile)) printf("Cannot write %s\n", traceFile);
+    }
+
+    delete timeStepper;
+    delete windowSystem;
+    return 0;
+}
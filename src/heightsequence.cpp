@@ -0,0 +1,554 @@
+#include "heightsequence.h"
+
+#include <algorithm>
+#include <cstring>
+
+#ifdef _WIN32
+#include <fstream>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "lodepng.h"
+
+namespace
+{
+const char MAGIC[8] = { 'A', '3', 'H', 'S', 'E', 'Q', '\r', '\n' };
+const uint32_t VERSION = 1;
+const size_t FRAME_ALIGN = 8;
+
+// file layout, written as is
+struct Header {
+    char magic[8];
+    uint32_t version;
+    uint32_t encoding;
+    uint32_t width;
+    uint32_t height;
+    uint32_t frames;
+    uint32_t keyEvery;              // TILE_DELTA keyframe interval, 0 if none
+    uint64_t indexOffset;
+};
+static_assert(sizeof(Header) == 40, "sequence header must not be padded");
+const size_t ENTRY_BYTES = 24;      // uint64 offset, uint64 bytes, double time
+
+const char* ENCODING_NAMES[] = { "float32", "float16", "delta_lz", "tile_delta" };
+
+// first byte of a TILE_DELTA payload, before the deflate stream
+enum FrameKind { KEY_FRAME = 0, DELTA_FRAME = 1 };
+
+bool seekTo(FILE* f, uint64_t offset) {
+#ifdef _WIN32
+    return _fseeki64(f, (__int64)offset, SEEK_SET) == 0;
+#else
+    return fseeko(f, (off_t)offset, SEEK_SET) == 0;
+#endif
+}
+
+// a bitmap of the non-zero cells, then the non-zero heights as deltas of
+// their bits, byte k of every delta in plane k: the glass is mostly dry,
+// and the high bytes of neighbouring wet heights are mostly equal, so both
+// deflate to very little
+void packSparse(const GridView<const float>& heights, vector<unsigned char>& packed) {
+    size_t n = (size_t)heights.width * heights.height;
+    size_t maskBytes = (n + 7) / 8;
+    packed.assign(maskBytes, 0);
+    vector<uint32_t> deltas;
+    uint32_t prev = 0;
+    size_t i = 0;
+    for (int y=0; y<heights.height; ++y) {
+        const float* row = heights.row(y);
+        for (int x=0; x<heights.width; ++x, ++i) {
+            uint32_t bits;
+            memcpy(&bits, &row[x], sizeof(bits));
+            if (bits == 0) continue;
+            packed[i >> 3] |= (unsigned char)(1 << (i & 7));
+            deltas.push_back(bits - prev);
+            prev = bits;
+        }
+    }
+    size_t k = deltas.size();
+    packed.resize(maskBytes + 4 * k);
+    unsigned char* planes = packed.data() + maskBytes;
+    for (size_t j=0; j<k; ++j) {
+        planes[j] = (unsigned char)deltas[j];
+        planes[k + j] = (unsigned char)(deltas[j] >> 8);
+        planes[2*k + j] = (unsigned char)(deltas[j] >> 16);
+        planes[3*k + j] = (unsigned char)(deltas[j] >> 24);
+    }
+}
+
+bool unpackSparse(const vector<unsigned char>& packed, const GridView<float>& out) {
+    size_t n = (size_t)out.width * out.height;
+    size_t maskBytes = (n + 7) / 8;
+    if (packed.size() < maskBytes || (packed.size() - maskBytes) % 4 != 0) {
+        return false;
+    }
+    size_t k = (packed.size() - maskBytes) / 4;
+    const unsigned char* planes = packed.data() + maskBytes;
+    uint32_t prev = 0;
+    size_t i = 0, j = 0;
+    for (int y=0; y<out.height; ++y) {
+        float* row = out.row(y);
+        for (int x=0; x<out.width; ++x, ++i) {
+            uint32_t bits = 0;
+            if (packed[i >> 3] & (1 << (i & 7))) {
+                if (j == k) return false;
+                prev += planes[j] | (uint32_t)planes[k + j] << 8 |
+                        (uint32_t)planes[2*k + j] << 16 | (uint32_t)planes[3*k + j] << 24;
+                bits = prev;
+                ++j;
+            }
+            memcpy(&row[x], &bits, sizeof(bits));
+        }
+    }
+    return j == k;
+}
+
+// a TILE_DELTA delta frame: a bitmap of the changed tiles, a bitmap of
+// the cells that changed in them (tile by tile, row by row), then the
+// changed cells' bits minus their bits in the previous frame, in byte
+// planes
+bool applyDelta(const vector<unsigned char>& packed, const GridView<float>& out) {
+    const int S = TileMask::TILE_SIZE;
+    int tilesX = (out.width + S - 1) / S, tilesY = (out.height + S - 1) / S;
+    size_t tileBytes = ((size_t)tilesX * tilesY + 7) / 8;
+    if (packed.size() < tileBytes) return false;
+    size_t cells = 0;
+    for (int t=0; t<tilesX*tilesY; ++t) {
+        if (!(packed[t >> 3] & (1 << (t & 7)))) continue;
+        int ty = t / tilesX, tx = t % tilesX;
+        cells += (size_t)(min(out.width, (tx+1)*S) - tx*S) * (min(out.height, (ty+1)*S) - ty*S);
+    }
+    size_t maskBytes = tileBytes + (cells + 7) / 8;
+    if (packed.size() < maskBytes || (packed.size() - maskBytes) % 4 != 0) {
+        return false;
+    }
+    const unsigned char* mask = packed.data() + tileBytes;
+    size_t k = (packed.size() - maskBytes) / 4;
+    const unsigned char* planes = packed.data() + maskBytes;
+    size_t i = 0, j = 0;
+    for (int t=0; t<tilesX*tilesY; ++t) {
+        if (!(packed[t >> 3] & (1 << (t & 7)))) continue;
+        int ty = t / tilesX, tx = t % tilesX;
+        int x0 = tx*S, x1 = min(out.width, x0 + S);
+        int y1 = min(out.height, (ty+1)*S);
+        for (int y=ty*S; y<y1; ++y) {
+            float* row = out.row(y);
+            for (int x=x0; x<x1; ++x, ++i) {
+                if (!(mask[i >> 3] & (1 << (i & 7)))) continue;
+                if (j == k) return false;
+                uint32_t bits;
+                memcpy(&bits, &row[x], sizeof(bits));
+                bits += planes[j] | (uint32_t)planes[k + j] << 8 |
+                        (uint32_t)planes[2*k + j] << 16 | (uint32_t)planes[3*k + j] << 24;
+                memcpy(&row[x], &bits, sizeof(bits));
+                ++j;
+            }
+        }
+    }
+    return j == k;
+}
+}
+
+// ---------------- HeightSequence -------------------------
+
+const char* HeightSequence::encodingName(Encoding encoding) {
+    return ENCODING_NAMES[encoding];
+}
+
+void HeightSequence::encode(const GridView<const float>& heights, Encoding encoding,
+        vector<unsigned char>& out) {
+    size_t n = (size_t)heights.width * heights.height;
+    out.clear();
+    if (encoding == FLOAT32) {
+        out.resize(n * sizeof(float));
+        for (int y=0; y<heights.height; ++y) {
+            memcpy(&out[(size_t)y * heights.width * sizeof(float)], heights.row(y),
+                    heights.width * sizeof(float));
+        }
+    } else if (encoding == FLOAT16) {
+        out.resize(n * sizeof(uint16_t));
+        uint16_t* halves = (uint16_t*)out.data();
+        for (int y=0; y<heights.height; ++y) {
+            const float* row = heights.row(y);
+            for (int x=0; x<heights.width; ++x) {
+                *halves++ = floatToHalf(row[x]);
+            }
+        }
+    } else {
+        vector<unsigned char> packed;
+        packSparse(heights, packed);
+        if (encoding == TILE_DELTA) {
+            out.push_back(KEY_FRAME);
+        }
+        lodepng::compress(out, packed);
+    }
+}
+
+bool HeightSequence::decode(const unsigned char* bytes, size_t size, Encoding encoding,
+        const GridView<float>& out) {
+    size_t n = (size_t)out.width * out.height;
+    if (encoding == FLOAT32) {
+        if (size != n * sizeof(float)) return false;
+        for (int y=0; y<out.height; ++y) {
+            memcpy(out.row(y), bytes + (size_t)y * out.width * sizeof(float),
+                    out.width * sizeof(float));
+        }
+    } else if (encoding == FLOAT16) {
+        if (size != n * sizeof(uint16_t)) return false;
+        for (int y=0; y<out.height; ++y) {
+            float* row = out.row(y);
+            for (int x=0; x<out.width; ++x) {
+                uint16_t half;
+                memcpy(&half, bytes, sizeof(half));
+                bytes += sizeof(half);
+                row[x] = halfToFloat(half);
+            }
+        }
+    } else {
+        unsigned char kind = KEY_FRAME;
+        if (encoding == TILE_DELTA) {
+            if (size == 0) return false;
+            kind = *bytes++;
+            --size;
+        }
+        vector<unsigned char> packed;
+        if (lodepng::decompress(packed, bytes, size) != 0) return false;
+        if (kind == KEY_FRAME) return unpackSparse(packed, out);
+        if (kind == DELTA_FRAME) return applyDelta(packed, out);
+        return false;
+    }
+    return true;
+}
+
+bool HeightSequence::isKeyFrame(const unsigned char* bytes, size_t size, Encoding encoding) {
+    return encoding != TILE_DELTA || (size > 0 && bytes[0] == KEY_FRAME);
+}
+
+void HeightSequence::packDelta(const GridView<const float>& heights, const GridView<float>& baseline,
+        const TileMask& changed, vector<unsigned char>& packed) {
+    int tiles = changed.rows();
+    size_t tileBytes = ((size_t)tiles * tiles + 7) / 8;
+    size_t cells = changed.cellCount();
+    packed.assign(tileBytes + (cells + 7) / 8, 0);
+    unsigned char* mask = packed.data() + tileBytes;
+    vector<uint32_t> deltas;
+    size_t i = 0;
+    for (int ty=0; ty<tiles; ++ty) {
+        for (int tx=0; tx<tiles; ++tx) {
+            if (!changed.test(ty, tx)) continue;
+            int t = ty*tiles + tx;
+            packed[t >> 3] |= (unsigned char)(1 << (t & 7));
+            int x0 = changed.cellBegin(tx), x1 = changed.cellEnd(tx);
+            for (int y=changed.cellBegin(ty); y<changed.cellEnd(ty); ++y) {
+                const float* row = heights.row(y);
+                float* base = baseline.row(y);
+                for (int x=x0; x<x1; ++x, ++i) {
+                    uint32_t bits, before;
+                    memcpy(&bits, &row[x], sizeof(bits));
+                    memcpy(&before, &base[x], sizeof(before));
+                    if (bits == before) continue;
+                    mask[i >> 3] |= (unsigned char)(1 << (i & 7));
+                    deltas.push_back(bits - before);
+                    base[x] = row[x];
+                }
+            }
+        }
+    }
+    size_t k = deltas.size();
+    size_t maskBytes = packed.size();
+    packed.resize(maskBytes + 4 * k);
+    unsigned char* planes = packed.data() + maskBytes;
+    for (size_t j=0; j<k; ++j) {
+        planes[j] = (unsigned char)deltas[j];
+        planes[k + j] = (unsigned char)(deltas[j] >> 8);
+        planes[2*k + j] = (unsigned char)(deltas[j] >> 16);
+        planes[3*k + j] = (unsigned char)(deltas[j] >> 24);
+    }
+}
+
+void HeightSequence::deflateDelta(const vector<unsigned char>& packed, vector<unsigned char>& out) {
+    out.assign(1, DELTA_FRAME);
+    lodepng::compress(out, packed);
+}
+
+uint16_t HeightSequence::floatToHalf(float f) {
+    uint32_t bits;
+    memcpy(&bits, &f, sizeof(bits));
+    uint16_t sign = (uint16_t)((bits >> 16) & 0x8000);
+    uint32_t magnitude = bits & 0x7fffffff;
+
+    if (magnitude >= 0x7f800000) {
+        // infinity stays infinity, a NaN stays a (quiet) NaN
+        return sign | 0x7c00 | (magnitude > 0x7f800000 ? 0x200 : 0);
+    }
+    if (magnitude >= 0x477ff000) {
+        return sign | 0x7c00;       // rounds past 65504
+    }
+    if (magnitude < 0x38800000) {
+        // below 2^-14: a subnormal half, m * 2^-24
+        if (magnitude < 0x33000000) return sign;
+        int exponent = magnitude >> 23;
+        uint32_t mantissa = (magnitude & 0x7fffff) | 0x800000;
+        int shift = 126 - exponent;
+        uint32_t m = mantissa >> shift;
+        uint32_t rest = mantissa & ((1u << shift) - 1);
+        uint32_t halfway = 1u << (shift - 1);
+        if (rest > halfway || (rest == halfway && (m & 1))) ++m;
+        return sign | (uint16_t)m;
+    }
+    // rebias the exponent and round the mantissa to 10 bits, ties to even;
+    // a carry correctly bumps the exponent
+    uint32_t m = magnitude - 0x38000000;
+    uint32_t rest = m & 0x1fff;
+    m >>= 13;
+    if (rest > 0x1000 || (rest == 0x1000 && (m & 1))) ++m;
+    return sign | (uint16_t)m;
+}
+
+float HeightSequence::halfToFloat(uint16_t h) {
+    uint32_t sign = (uint32_t)(h & 0x8000) << 16;
+    uint32_t exponent = (h >> 10) & 0x1f;
+    uint32_t mantissa = h & 0x3ff;
+    uint32_t bits;
+    if (exponent == 0) {
+        float f = mantissa * (1.f / 16777216.f);
+        return sign ? -f : f;
+    } else if (exponent == 31) {
+        bits = sign | 0x7f800000 | (mantissa << 13);
+    } else {
+        bits = sign | ((exponent + 112) << 23) | (mantissa << 13);
+    }
+    float f;
+    memcpy(&f, &bits, sizeof(f));
+    return f;
+}
+
+// ---------------- HeightSequenceWriter -------------------------
+
+HeightSequenceWriter::HeightSequenceWriter() :
+    file(nullptr),
+    w(0),
+    h(0),
+    enc(HeightSequence::FLOAT32),
+    keyInterval(0),
+    end(0),
+    failed(false) {}
+
+HeightSequenceWriter::~HeightSequenceWriter() {
+    close();
+}
+
+bool HeightSequenceWriter::open(const string& filename, int width_, int height_,
+        HeightSequence::Encoding encoding_, int keyEvery_) {
+    close();
+    file = fopen(filename.c_str(), "wb");
+    if (!file) return false;
+    path = filename;
+    w = width_;
+    h = height_;
+    enc = encoding_;
+    keyInterval = encoding_ == HeightSequence::TILE_DELTA ? max(1, keyEvery_) : 0;
+    index.clear();
+    failed = false;
+    end = sizeof(Header);
+    // a header with no index until the first sync
+    return sync();
+}
+
+bool HeightSequenceWriter::append(const GridView<const float>& heights, double time) {
+    HeightSequence::encode(heights, enc, scratch);
+    return appendEncoded(scratch, time);
+}
+
+bool HeightSequenceWriter::appendEncoded(const vector<unsigned char>& bytes, double time) {
+    if (!file) return false;
+    static const unsigned char PADDING[FRAME_ALIGN] = {};
+    size_t pad = (FRAME_ALIGN - bytes.size() % FRAME_ALIGN) % FRAME_ALIGN;
+    bool ok = seekTo(file, end) &&
+            fwrite(bytes.data(), 1, bytes.size(), file) == bytes.size() &&
+            fwrite(PADDING, 1, pad, file) == pad;
+    if (!ok) {
+        failed = true;
+        return false;
+    }
+    Entry e;
+    e.offset = end;
+    e.bytes = bytes.size();
+    e.time = time;
+    index.push_back(e);
+    end += bytes.size() + pad;
+    return true;
+}
+
+bool HeightSequenceWriter::sync() {
+    if (!file) return false;
+    Header header;
+    memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.version = VERSION;
+    header.encoding = enc;
+    header.width = w;
+    header.height = h;
+    header.frames = (uint32_t)index.size();
+    header.keyEvery = keyInterval;
+    header.indexOffset = end;
+
+    bool ok = !failed && seekTo(file, end);
+    for (size_t i=0; ok && i<index.size(); ++i) {
+        const Entry& e = index[i];
+        ok = fwrite(&e.offset, sizeof(e.offset), 1, file) == 1 &&
+                fwrite(&e.bytes, sizeof(e.bytes), 1, file) == 1 &&
+                fwrite(&e.time, sizeof(e.time), 1, file) == 1;
+    }
+    ok = ok && seekTo(file, 0) &&
+            fwrite(&header, sizeof(header), 1, file) == 1 &&
+            fflush(file) == 0;
+    failed = failed || !ok;
+    return ok;
+}
+
+bool HeightSequenceWriter::close() {
+    if (!file) return true;
+    bool ok = sync();
+    ok = fclose(file) == 0 && ok;
+    file = nullptr;
+    return ok;
+}
+
+// ---------------- HeightSequenceReader -------------------------
+
+HeightSequenceReader::HeightSequenceReader() :
+    base(nullptr),
+    size(0),
+    w(0),
+    h(0),
+    frameCount(0),
+    enc(HeightSequence::FLOAT32),
+    keyInterval(0),
+    table(nullptr) {}
+
+HeightSequenceReader::~HeightSequenceReader() {
+    close();
+}
+
+bool HeightSequenceReader::open(const string& filename) {
+    close();
+#ifdef _WIN32
+    ifstream in(filename.c_str(), ios::binary);
+    if (!in) return false;
+    contents.assign(istreambuf_iterator<char>(in), istreambuf_iterator<char>());
+    if (contents.empty()) return false;
+    base = contents.data();
+    size = contents.size();
+#else
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size < (off_t)sizeof(Header)) {
+        ::close(fd);
+        return false;
+    }
+    void* mapped = mmap(nullptr, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);                    // the mapping keeps the file open
+    if (mapped == MAP_FAILED) return false;
+    base = (const unsigned char*)mapped;
+    size = info.st_size;
+#endif
+
+    Header header;
+    bool ok = size >= sizeof(Header);
+    if (ok) {
+        memcpy(&header, base, sizeof(header));
+        ok = memcmp(header.magic, MAGIC, sizeof(MAGIC)) == 0 &&
+                header.version == VERSION &&
+                header.encoding <= HeightSequence::TILE_DELTA &&
+                header.indexOffset >= sizeof(Header) &&
+                header.indexOffset <= size &&
+                (size - header.indexOffset) / ENTRY_BYTES >= header.frames;
+    }
+    if (ok) {
+        w = header.width;
+        h = header.height;
+        enc = (HeightSequence::Encoding)header.encoding;
+        frameCount = header.frames;
+        keyInterval = header.keyEvery;
+        table = base + header.indexOffset;
+        // every frame has to lie between the header and the index
+        for (int i=0; ok && i<frameCount; ++i) {
+            uint64_t offset, bytes;
+            memcpy(&offset, entry(i), sizeof(offset));
+            memcpy(&bytes, entry(i) + 8, sizeof(bytes));
+            ok = offset >= sizeof(Header) && offset <= header.indexOffset &&
+                    bytes <= header.indexOffset - offset;
+        }
+    }
+    if (!ok) close();
+    return ok;
+}
+
+void HeightSequenceReader::close() {
+#ifdef _WIN32
+    contents.clear();
+#else
+    if (base) munmap((void*)base, size);
+#endif
+    base = nullptr;
+    size = 0;
+    w = h = frameCount = keyInterval = 0;
+    table = nullptr;
+}
+
+const unsigned char* HeightSequenceReader::entry(int frame) const {
+    return table + (size_t)frame * ENTRY_BYTES;
+}
+
+double HeightSequenceReader::time(int frame) const {
+    double t;
+    memcpy(&t, entry(frame) + 16, sizeof(t));
+    return t;
+}
+
+size_t HeightSequenceReader::frameBytes(int frame) const {
+    uint64_t bytes;
+    memcpy(&bytes, entry(frame) + 8, sizeof(bytes));
+    return (size_t)bytes;
+}
+
+const unsigned char* HeightSequenceReader::payload(int frame) const {
+    uint64_t offset;
+    memcpy(&offset, entry(frame), sizeof(offset));
+    return base + offset;
+}
+
+bool HeightSequenceReader::isKeyFrame(int frame) const {
+    return HeightSequence::isKeyFrame(payload(frame), frameBytes(frame), enc);
+}
+
+bool HeightSequenceReader::frame(int frame, Grid2D<float>& out, int have) const {
+    if (frame < 0 || frame >= frameCount) return false;
+    int key = frame;
+    while (key >= 0 && !isKeyFrame(key)) --key;
+    if (key < 0) return false;
+    if (out.width() != w || out.height() != h) {
+        out.resize(w, h);
+        have = -1;
+    }
+    int from = have >= key && have < frame ? have + 1 : key;
+    for (int f=from; f<=frame; ++f) {
+        if (!HeightSequence::decode(payload(f), frameBytes(f), enc, out.view())) {
+            return false;
+        }
+    }
+    return true;
+}
+
+GridView<const float> HeightSequenceReader::view(int frame) const {
+    if (enc != HeightSequence::FLOAT32 || frame < 0 || frame >= frameCount ||
+            frameBytes(frame) != (size_t)w * h * sizeof(float)) {
+        return GridView<const float>();
+    }
+    return GridView<const float>((const float*)payload(frame), w, h, w);
+}
@@ -0,0 +1,174 @@
+#ifndef HEIGHTSEQUENCE_H
+#define HEIGHTSEQUENCE_H
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "grid2d.h"
+#include "tilemask.h"
+
+using namespace std;
+
+// A whole heightmap sequence in one file (.a3seq), instead of a PNG per
+// frame.
+//
+// The file is a fixed header, the frames one after the other (each
+// starting on an 8 byte boundary), then an index table of every frame's
+// offset, size and simulated time. The header points at the index, so a
+// reader finds any frame in O(1). All frames share one encoding:
+//   FLOAT32   the heights as they are, row 0 first
+//   FLOAT16   IEEE half floats, rounded to nearest (about 3 digits)
+//   DELTA_LZ  lossless: each height's bits minus those of the previous
+//             height in the frame, split into byte planes and deflated,
+//             so dry glass costs next to nothing
+//   TILE_DELTA  lossless keyframes packed like DELTA_LZ, and between them
+//             delta frames: a bitmap of the TileMask tiles that may have
+//             changed since the previous frame, a bitmap of the cells of
+//             those tiles that did, and those cells' bits minus their bits
+//             in the previous frame, in byte planes, deflated
+// Apart from TILE_DELTA delta frames, which need the frames back to their
+// keyframe, frames are independent of each other. Values are written in
+// the host's byte order (little endian in practice).
+class HeightSequence {
+public:
+    enum Encoding { FLOAT32, FLOAT16, DELTA_LZ, TILE_DELTA };
+
+    // Static Helpers
+    static const char* encodingName(Encoding encoding);
+    // frame payload of heights in the given encoding (a keyframe for
+    // TILE_DELTA); safe to call from any thread, so frames can be encoded
+    // in parallel and appended in order
+    static void encode(const GridView<const float>& heights, Encoding encoding,
+            vector<unsigned char>& out);
+    // inverse of encode, into a width x height view; a TILE_DELTA delta
+    // frame is applied to out, which must hold the frame before it. False
+    // if bytes is corrupt
+    static bool decode(const unsigned char* bytes, size_t size, Encoding encoding,
+            const GridView<float>& out);
+    // false only for TILE_DELTA delta frames
+    static bool isKeyFrame(const unsigned char* bytes, size_t size, Encoding encoding);
+    // first half of a TILE_DELTA delta frame: the changed tiles of heights
+    // as changes from baseline (the previous frame), which is brought up to
+    // date in those tiles. Reads nothing outside them, so its cost follows
+    // the motion rather than the grid size
+    static void packDelta(const GridView<const float>& heights, const GridView<float>& baseline,
+            const TileMask& changed, vector<unsigned char>& packed);
+    // second half, off the simulation thread: packed to a frame payload
+    static void deflateDelta(const vector<unsigned char>& packed, vector<unsigned char>& out);
+    static uint16_t floatToHalf(float f);
+    static float halfToFloat(uint16_t h);
+};
+
+// Appends frames to a sequence file as they are produced.
+//
+// The index only lives in memory until sync() or close() writes it after
+// the last frame (the next append overwrites it and a later sync writes
+// it again), so the file is readable after every sync but not in between.
+class HeightSequenceWriter {
+public:
+    // Constructor, Destructor
+    HeightSequenceWriter();
+    ~HeightSequenceWriter();        // closes the file
+
+    // Configuration
+    // creates (or truncates) filename; false if it cannot be written.
+    // keyEvery_ only documents a TILE_DELTA writer's keyframe interval:
+    // append() writes keyframes only, delta frames come through
+    // appendEncoded from a caller that knows which tiles changed
+    bool open(const string& filename, int width_, int height_,
+            HeightSequence::Encoding encoding_, int keyEvery_ = 0);
+
+    // Helper Observers
+    bool isOpen() const { return file != nullptr; }
+    int width() const { return w; }
+    int height() const { return h; }
+    int frames() const { return (int)index.size(); }
+    HeightSequence::Encoding encoding() const { return enc; }
+    int keyEvery() const { return keyInterval; }
+    const string& filename() const { return path; }
+
+    // State Mutators
+    // encodes and appends one width x height frame taken at simulated time
+    bool append(const GridView<const float>& heights, double time);
+    // appends a frame already packed by HeightSequence::encode
+    bool appendEncoded(const vector<unsigned char>& bytes, double time);
+    bool sync();                    // writes the index and the header
+    bool close();                   // sync, then closes the file
+
+private:
+    struct Entry {
+        uint64_t offset;
+        uint64_t bytes;
+        double time;
+    };
+
+    FILE* file;
+    string path;
+    int w;
+    int h;
+    HeightSequence::Encoding enc;
+    int keyInterval;
+    uint64_t end;                   // where the next frame (or the index) goes
+    vector<Entry> index;
+    vector<unsigned char> scratch;  // append's encoded frame
+    bool failed;                    // a write failed since open
+};
+
+// Random access to a sequence file through a read-only memory map.
+//
+// Opening maps the file and checks the header and index; after that a
+// frame is a table lookup plus its decode (from its keyframe on, for
+// TILE_DELTA), and FLOAT32 frames can be read in place without a copy.
+// The reader keeps no state between calls, so it may serve several
+// threads.
+class HeightSequenceReader {
+public:
+    // Constructor, Destructor
+    HeightSequenceReader();
+    ~HeightSequenceReader();        // unmaps the file
+
+    // Configuration
+    // false if the file is missing, truncated or not a sequence
+    bool open(const string& filename);
+    void close();
+
+    // Helper Observers
+    bool isOpen() const { return base != nullptr; }
+    int width() const { return w; }
+    int height() const { return h; }
+    int frames() const { return frameCount; }
+    HeightSequence::Encoding encoding() const { return enc; }
+    int keyEvery() const { return keyInterval; }
+    double time(int frame) const;
+    size_t frameBytes(int frame) const;
+    bool isKeyFrame(int frame) const;
+    size_t fileBytes() const { return size; }
+
+    // decodes frame into out (resized to width x height); false if corrupt.
+    // If out already holds frame have, TILE_DELTA frames after it are
+    // decoded from there instead of from the keyframe, so reading a
+    // sequence in order decodes every frame once
+    bool frame(int frame, Grid2D<float>& out, int have = -1) const;
+    // FLOAT32 only: the frame straight from the map, valid until close()
+    GridView<const float> view(int frame) const;
+
+private:
+    const unsigned char* entry(int frame) const;
+    const unsigned char* payload(int frame) const;
+
+    const unsigned char* base;      // the mapped file
+    size_t size;
+    int w;
+    int h;
+    int frameCount;
+    HeightSequence::Encoding enc;
+    int keyInterval;
+    const unsigned char* table;     // frameCount index entries
+#ifdef _WIN32
+    vector<unsigned char> contents; // read whole, no mmap
+#endif
+};
+
+#endif
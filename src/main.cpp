@@ -10,6 +10,7 @@
 #include "vertexrecorder.h"
 #include "starter3_util.h"
 #include "camera.h"
+#include "simloop.h"
 #include "timestepper.h"
 #include "windowsystem.h"
 #include "Image.h"
@@ -21,10 +22,9 @@ namespace
 
 // Declarations of functions whose implementations occur later.
 void initSystem();
-void stepSystem();
 void drawSystem();
 void freeSystem();
-void resetTime();
+void reportSystem();
 
 void initRendering();
 void drawAxis();
@@ -35,17 +35,19 @@ const Vector3f LIGHT_COLOR(120.0f, 120.0f, 120.0f);
 const Vector3f FLOOR_COLOR(1.0f, 0.0f, 0.0f);
 
 // time keeping
-// current "tick" (e.g. clock number of processor)
-uint64_t start_tick;
-// number of seconds since start of program
-double elapsed_s;
-// number of seconds simulated
-double simulated_s;
+// the simulation runs on its own thread, see SimLoop
+const double REPORT_INTERVAL_S = 5.0;
+// steps per profile summary while profiling is toggled on
+const int PROFILE_EVERY_STEPS = 500;
+// wall clock of the last progress report
+double last_report_s;
 
 // Globals here.
 TimeStepper* timeStepper;
+SimLoop* simLoop;
 float h;
 char integrator;
+int maxStepsPerFrame = 8;
 
 Camera camera;
 bool gMousePressed = false;
@@ -67,7 +69,8 @@ static void keyCallback(GLFWwindow* window, int key,
     // here: http://www.glfw.org/docs/latest/group__keys.html
     switch (key) {
     case GLFW_KEY_ESCAPE: // Escape key
-        exit(0);
+        // leave the main loop so the simulation thread is joined
+        glfwSetWindowShouldClose(window, GLFW_TRUE);
         break;
     case ' ':
     {
@@ -81,7 +84,6 @@ static void keyCallback(GLFWwindow* window, int key,
         cout << "Resetting simulation\n";
         freeSystem();
         initSystem();
-        resetTime();
         break;
     }
     case 'W':
@@ -89,6 +91,13 @@ static void keyCallback(GLFWwindow* window, int key,
         cout << "Toggling Wind\n";
         break;
     }
+    case 'T':
+    {
+        Profiler& profiler = windowSystem->profiler();
+        profiler.setEnabled(!profiler.enabled());
+        cout << "Profiling " << (profiler.enabled() ? "on" : "off") << endl;
+        break;
+    }
     case 'P':
     {
         cout << "Toggling Drag Mode\n";
@@ -190,30 +199,39 @@ void drawAxis()
 void initSystem()
 {
     switch (integrator) {
+    case 'e': timeStepper = new ForwardEuler(); break;
+    case 's': timeStepper = new SemiImplicitEuler(); break;
+    case 'm': timeStepper = new Midpoint(); break;
     case 'r': timeStepper = new RK4(); break;
+    case 'a': timeStepper = new RK45(); break;
+    case 'c': timeStepper = new CFLStepper(); break;
     default: printf("Unrecognized integrator\n"); exit(-1);
     }
 
     windowSystem = new WindowSystem();
+    windowSystem->profiler().setSummaryEvery(PROFILE_EVERY_STEPS);
+
+    // fixed steps of h on the simulation thread, at most
+    // maxStepsPerFrame per tick before time is dilated
+    simLoop = new SimLoop(windowSystem, timeStepper, h, maxStepsPerFrame);
+    simLoop->start();
+    last_report_s = glfwGetTime();
 }
 
 void freeSystem() {
+    // the simulation thread must stop before the system goes away
+    delete simLoop; simLoop = nullptr;
     delete timeStepper; timeStepper = nullptr;
     delete windowSystem; windowSystem = nullptr;
 }
 
-void resetTime() {
-    elapsed_s = 0;
-    simulated_s = 0;
-    start_tick = glfwGetTimerValue();
-}
-
-void stepSystem()
+void reportSystem()
 {
-    // step until simulated_s has caught up with elapsed_s.
-    while (simulated_s < elapsed_s) {
-        timeStepper->takeStep(windowSystem, h);
-        simulated_s += h;
+    // periodically report how far the simulation lags behind real time
+    double now = glfwGetTime();
+    if (now - last_report_s >= REPORT_INTERVAL_S) {
+        simLoop->printReport();
+        last_report_s = now;
     }
 }
 
@@ -225,7 +243,11 @@ void drawSystem()
     GLProgram gl(program_light, program_color, &camera);
     gl.updateLight(LIGHT_POS, LIGHT_COLOR.xyz()); // once per frame
 
-    windowSystem->draw(gl);
+    // draw the latest heightmap published by the simulation thread
+    const SimLoop::Snapshot* snapshot = simLoop->acquire();
+    if (snapshot) {
+        windowSystem->draw(gl, snapshot->heights.view());
+    }
 
     // set uniforms for floor
     gl.updateMaterial(FLOOR_COLOR);
@@ -250,12 +272,21 @@ void initRendering()
 // Set up OpenGL, define the callbacks and start the main loop
 int main(int argc, char** argv)
 {
-    if (argc != 3) {
-        printf("Usage: %s <e|t|r> <timestep>\n", argv[0]);
+    if (argc != 3 && argc != 4) {
+        printf("Usage: %s <e|s|m|r|a|c> <timestep> [max steps per frame]\n", argv[0]);
+        printf("       e: Integrator: Forward Euler\n");
+        printf("       s: Integrator: Semi-implicit Euler\n");
+        printf("       m: Integrator: Midpoint\n");
         printf("       r: Integrator: RK 4\n");
+        printf("       a: Integrator: adaptive RK 45\n");
+        printf("       c: Integrator: RK 4, fast droplets sub-stepped\n");
+        printf("       when a frame owes more steps than the budget (default 8),\n");
+        printf("       the rest is dropped and the simulation runs in slow motion\n");
+        printf("       (press T to print where step time goes every %d steps)\n",
+                PROFILE_EVERY_STEPS);
         printf("\n");
-        printf("Try  : %s t 0.001\n", argv[0]);
-        printf("       for trapezoid (1ms steps)\n");
+        printf("Try  : %s e 0.001\n", argv[0]);
+        printf("       for Forward Euler (1ms steps)\n");
         printf("Or   : %s r 0.01\n", argv[0]);
         printf("       for RK4 (10ms steps)\n");
         return -1;
@@ -263,7 +294,11 @@ int main(int argc, char** argv)
 
     integrator = argv[1][0];
     h = (float)atof(argv[2]);
-    printf("Using Integrator %c with time step %.4f\n", integrator, h);
+    if (argc == 4) {
+        maxStepsPerFrame = atoi(argv[3]);
+    }
+    printf("Using Integrator %c with time step %.4f, at most %d steps per frame\n",
+            integrator, h, maxStepsPerFrame);
 
 
     GLFWwindow* window = createOpenGLWindow(1024, 1024, "Assignment 3");
@@ -297,8 +332,6 @@ int main(int argc, char** argv)
     initSystem();
 
     // Main Loop
-    uint64_t freq = glfwGetTimerFrequency();
-    resetTime();
     while (!glfwWindowShouldClose(window)) {
         // Clear the rendering window
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
@@ -309,9 +342,7 @@ int main(int argc, char** argv)
             drawAxis();
         }
 
-        uint64_t now = glfwGetTimerValue();
-        elapsed_s = (double)(now - start_tick) / freq;
-        stepSystem();
+        reportSystem();
 
         // Draw the simulation
         //drawSystem();
@@ -328,6 +359,9 @@ int main(int argc, char** argv)
     glDeleteProgram(program_color);
     glDeleteProgram(program_light);
 
+    simLoop->printReport();
+    freeSystem();
+
 
-    return 0;	// This line is never reached.
+    return 0;
 }
@@ -1,19 +1,12 @@
 #include "particlesystem.h"
 
+#ifndef HEADLESS
 #include "gl.h"
 #include "camera.h"
-#include <random>
+#endif
 #include <cstdio>
 
-float rand_uniform(float low, float hi) {
-   float abs = hi - low;
-   float f = (float)rand() / RAND_MAX;
-   f *= abs;
-   f += low;
-   //printf("rand %.2f\n", f);
-   return f;
-}
-
+#ifndef HEADLESS
 GLProgram::GLProgram(uint32_t apl, uint32_t apc, Camera* ac)
     : program_light(apl), program_color(apc), camera(ac) {
     enableLighting();
@@ -56,5 +49,4 @@ void GLProgram::updateLight(Vector3f pos, Vector3f color) const {
     loc = glGetUniformLocation(active_program, "lightDiff");
     glUniform3fv(loc, 1, color);
 }
-
-
+#endif
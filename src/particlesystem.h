@@ -1,7 +1,6 @@
 #ifndef PARTICLESYSTEM_H
 #define PARTICLESYSTEM_H
 
-#include <map>
 #include <vector>
 #include <vecmath.h>
 
@@ -9,25 +8,33 @@
 
 using namespace std;
 
-// helper for uniform distribution
-float rand_uniform(float low, float hi);
-
 struct GLProgram;
 class ParticleSystem {
 public:
     virtual ~ParticleSystem() {}
 
-    // take a step
-    virtual void takeStep(float stepSize) {}
-
-    // for a given state, evaluate derivative f(X,t)
-    virtual map<int, Vector3f> evalAccel() = 0;
-
-
- protected:
-    map<int, Vector3f> m_vVecState;
-    map<int, Vector3f> posState;
-    map<int, Vector3f> velState;
+    // State Vector
+    // Interleaved (position, velocity) pairs, one pair per particle in
+    // dense particle order: state[2*i] is the position of particle i and
+    // state[2*i+1] its velocity.
+    virtual void getState(vector<Vector3f>& state) const = 0;
+    virtual void setState(const vector<Vector3f>& state) = 0;
+
+    // for a given state, evaluate derivative f(X,t) into f
+    // ((velocity, acceleration) pairs, same layout as the state)
+    virtual void evalF(const vector<Vector3f>& state, vector<Vector3f>& f) = 0;
+
+    // discrete changes once the state has been integrated over stepSize
+    // (particles appearing, splitting, merging...); called once per step
+    virtual void postStep(float stepSize) {}
+
+    // Per-particle Stepping (used by CFLStepper)
+    // acceleration of particle i alone at (pos, vel)
+    virtual Vector3f evalAccel(int i, const Vector3f& pos, const Vector3f& vel) = 0;
+    // farthest a particle may move in one substep; <= 0 means no limit
+    virtual float maxDisplacement() const { return 0.f; }
+    // particle i moved from -> to in one substep of a sub-stepped step
+    virtual void sweep(int i, const Vector3f& from, const Vector3f& to) {}
 };
 
 /* GLProgram is a helper for updating uniform variables.
@@ -0,0 +1,179 @@
+#include "profiler.h"
+
+#include <algorithm>
+
+namespace
+{
+const char* PHASE_NAMES[Profiler::PHASE_COUNT] = {
+    "integrate", "accel", "spawn", "split", "cull", "rasterize", "merge_scan",
+    "sleep", "merge_resolve", "blur", "erode", "tables", "export"
+};
+const char* COUNTER_NAMES[Profiler::COUNTER_COUNT] = {
+    "droplets", "active_cells", "merges"
+};
+}
+
+Profiler::Profiler() :
+    requested(false),
+    active(false),
+    recording(false),
+    tracing(false),
+    summaryEvery(0),
+    origin(Clock::now()),
+    depth(0),
+    stepCount(0),
+    windowFirst(0) {
+    fill(stepSeconds, stepSeconds + PHASE_COUNT, 0.0);
+    fill(counters, counters + COUNTER_COUNT, 0.0);
+    fill(totals, totals + PHASE_COUNT, 0.0);
+    fill(maxima, maxima + PHASE_COUNT, 0.0);
+    fill(counterTotals, counterTotals + COUNTER_COUNT, 0.0);
+    fill(counterMaxima, counterMaxima + COUNTER_COUNT, 0.0);
+    fill(windowSeconds, windowSeconds + PHASE_COUNT, 0.0);
+    fill(windowCounters, windowCounters + COUNTER_COUNT, 0.0);
+}
+
+const char* Profiler::phaseName(int phase) {
+    return PHASE_NAMES[phase];
+}
+
+const char* Profiler::counterName(int counter) {
+    return COUNTER_NAMES[counter];
+}
+
+void Profiler::end(Phase phase, Clock::time_point start) {
+    Clock::time_point now = Clock::now();
+    double elapsed = chrono::duration<double>(now - start).count();
+    double children = childSeconds.back();
+    childSeconds.pop_back();
+    --depth;
+
+    stepSeconds[phase] += elapsed - children;
+    if (depth > 0) {
+        childSeconds.back() += elapsed;
+    }
+    if (tracing) {
+        Event e;
+        e.phase = phase;
+        e.start = chrono::duration<double>(start - origin).count();
+        e.duration = elapsed;
+        events.push_back(e);
+    }
+    if (depth == 0) {
+        endStep();
+    }
+}
+
+void Profiler::endStep() {
+    ++stepCount;
+    for (int p=0; p<PHASE_COUNT; ++p) {
+        totals[p] += stepSeconds[p];
+        maxima[p] = max(maxima[p], stepSeconds[p]);
+        windowSeconds[p] += stepSeconds[p];
+    }
+    for (int c=0; c<COUNTER_COUNT; ++c) {
+        counterTotals[c] += counters[c];
+        counterMaxima[c] = max(counterMaxima[c], counters[c]);
+        windowCounters[c] += counters[c];
+    }
+    if (recording) {
+        Row row;
+        for (int p=0; p<PHASE_COUNT; ++p) row.ms[p] = (float)(stepSeconds[p] * 1e3);
+        copy(counters, counters + COUNTER_COUNT, row.counters);
+        rows.push_back(row);
+    }
+    if (tracing) {
+        Sample sample;
+        sample.time = chrono::duration<double>(Clock::now() - origin).count();
+        copy(counters, counters + COUNTER_COUNT, sample.counters);
+        samples.push_back(sample);
+    }
+    fill(stepSeconds, stepSeconds + PHASE_COUNT, 0.0);
+    fill(counters, counters + COUNTER_COUNT, 0.0);
+
+    if (summaryEvery > 0 && stepCount - windowFirst >= summaryEvery) {
+        printSummary(stdout);
+        windowFirst = stepCount;
+        fill(windowSeconds, windowSeconds + PHASE_COUNT, 0.0);
+        fill(windowCounters, windowCounters + COUNTER_COUNT, 0.0);
+    }
+}
+
+void Profiler::printSummary(FILE* out, bool sinceStart) const {
+    long first = sinceStart ? 0 : windowFirst;
+    long n = stepCount - first;
+    if (n <= 0) return;
+    const double* seconds = sinceStart ? totals : windowSeconds;
+    const double* values = sinceStart ? counterTotals : windowCounters;
+
+    double step = 0.0;
+    for (int p=0; p<PHASE_COUNT; ++p) step += seconds[p];
+    fprintf(out, "profile of steps %ld-%ld: %.3f ms/step\n", first + 1, stepCount, step * 1e3 / n);
+    for (int p=0; p<PHASE_COUNT; ++p) {
+        fprintf(out, "  %-14s %8.3f ms %5.1f%%\n", PHASE_NAMES[p], seconds[p] * 1e3 / n,
+                step > 0.0 ? 100.0 * seconds[p] / step : 0.0);
+    }
+    fprintf(out, " ");
+    for (int c=0; c<COUNTER_COUNT; ++c) {
+        fprintf(out, " %s %.1f", COUNTER_NAMES[c], values[c] / n);
+    }
+    fprintf(out, " (mean per step)\n");
+}
+
+bool Profiler::writeCsv(const string& filename) const {
+    FILE* out = fopen(filename.c_str(), "w");
+    if (!out) return false;
+    fprintf(out, "step");
+    for (int p=0; p<PHASE_COUNT; ++p) fprintf(out, ",%s_ms", PHASE_NAMES[p]);
+    for (int c=0; c<COUNTER_COUNT; ++c) fprintf(out, ",%s", COUNTER_NAMES[c]);
+    fprintf(out, "\n");
+    for (size_t i=0; i<rows.size(); ++i) {
+        fprintf(out, "%zu", i + 1);
+        for (int p=0; p<PHASE_COUNT; ++p) fprintf(out, ",%.4f", rows[i].ms[p]);
+        for (int c=0; c<COUNTER_COUNT; ++c) fprintf(out, ",%g", rows[i].counters[c]);
+        fprintf(out, "\n");
+    }
+    return fclose(out) == 0;
+}
+
+bool Profiler::writeJson(const string& filename) const {
+    FILE* out = fopen(filename.c_str(), "w");
+    if (!out) return false;
+    double n = max(1L, stepCount);
+    fprintf(out, "{\n  \"steps\": %ld,\n  \"phases\": {\n", stepCount);
+    for (int p=0; p<PHASE_COUNT; ++p) {
+        fprintf(out, "    \"%s\": {\"total_s\": %.6f, \"mean_ms\": %.4f, \"max_ms\": %.4f}%s\n",
+                PHASE_NAMES[p], totals[p], totals[p] * 1e3 / n, maxima[p] * 1e3,
+                p+1 < PHASE_COUNT ? "," : "");
+    }
+    fprintf(out, "  },\n  \"counters\": {\n");
+    for (int c=0; c<COUNTER_COUNT; ++c) {
+        fprintf(out, "    \"%s\": {\"mean\": %.3f, \"max\": %g}%s\n",
+                COUNTER_NAMES[c], counterTotals[c] / n, counterMaxima[c],
+                c+1 < COUNTER_COUNT ? "," : "");
+    }
+    fprintf(out, "  }\n}\n");
+    return fclose(out) == 0;
+}
+
+bool Profiler::writeTrace(const string& filename) const {
+    // load in chrome://tracing or Perfetto; times are in microseconds
+    FILE* out = fopen(filename.c_str(), "w");
+    if (!out) return false;
+    fprintf(out, "{\"traceEvents\":[\n");
+    const char* sep = "";
+    for (const Event& e : events) {
+        fprintf(out, "%s{\"name\":\"%s\",\"cat\":\"sim\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":1}",
+                sep, PHASE_NAMES[e.phase], e.start * 1e6, e.duration * 1e6);
+        sep = ",\n";
+    }
+    for (const Sample& s : samples) {
+        for (int c=0; c<COUNTER_COUNT; ++c) {
+            fprintf(out, "%s{\"name\":\"%s\",\"ph\":\"C\",\"ts\":%.3f,\"pid\":1,\"args\":{\"value\":%g}}",
+                    sep, COUNTER_NAMES[c], s.time * 1e6, s.counters[c]);
+            sep = ",\n";
+        }
+    }
+    fprintf(out, "\n]}\n");
+    return fclose(out) == 0;
+}
@@ -0,0 +1,162 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// Per-phase timing of simulation steps.
+//
+// PROFILE_SCOPE(profiler, phase) times the rest of the enclosing block.
+// Scopes nest, and each phase is charged its own time only (its elapsed
+// time minus that of the scopes inside it), so the phases of a step add
+// up to the step. A step is everything inside an outermost scope: the
+// callers wrap TimeStepper::takeStep in an INTEGRATE scope, whose own
+// time is the integrator's arithmetic.
+//
+// While disabled a scope costs a branch (and a relaxed load for an
+// outermost one); building with NO_PROFILE compiles the scopes out.
+// Scopes, counters and the outputs belong to the simulation thread;
+// setEnabled may be called from any thread and applies from the next step.
+class Profiler {
+public:
+    enum Phase {
+        INTEGRATE,                  // the stepper, outside the phases below
+        ACCEL,                      // evalF (CFLStepper forces count as INTEGRATE)
+        SPAWN,
+        SPLIT,
+        CULL,
+        RASTERIZE,
+        MERGE_SCAN,
+        SLEEP,
+        MERGE_RESOLVE,
+        BLUR,
+        ERODE,
+        TABLES,
+        EXPORT,
+        PHASE_COUNT
+    };
+    enum Counter {
+        DROPLETS,
+        ACTIVE_CELLS,               // cells in wet tiles
+        MERGES,                     // droplets created by merging
+        COUNTER_COUNT
+    };
+
+    class Scope {
+    public:
+        Scope(Profiler& p, Phase phase_) :
+            profiler(p.begin() ? &p : nullptr), phase(phase_) {
+            if (profiler) start = Clock::now();
+        }
+        ~Scope() {
+            if (profiler) profiler->end(phase, start);
+        }
+    private:
+        Profiler* profiler;         // nullptr while profiling is off
+        Phase phase;
+        chrono::steady_clock::time_point start;
+    };
+
+    // Constructor, Destructor
+    Profiler();
+    ~Profiler() {};
+
+    // Configuration
+    void setEnabled(bool on) { requested = on; }
+    void setSummaryEvery(int steps) { summaryEvery = steps; }  // 0 = never
+    void setRecording(bool on) { recording = on; }  // keep per-step rows for writeCsv
+    void setTracing(bool on) { tracing = on; }      // keep every scope for writeTrace
+
+    // Static Helpers
+    static const char* phaseName(int phase);
+    static const char* counterName(int counter);
+
+    // Helper Observers
+    bool enabled() const { return requested; }
+    long steps() const { return stepCount; }
+    double totalSeconds(Phase phase) const { return totals[phase]; }
+    // mean per step since the last summary, or since the start
+    void printSummary(FILE* out, bool sinceStart = false) const;
+    bool writeCsv(const string& filename) const;    // one row per recorded step
+    bool writeJson(const string& filename) const;   // totals, means and maxima
+    bool writeTrace(const string& filename) const;  // Chrome trace event format
+    // rows kept while recording: step k's own time in phase, and counters
+    int recordedSteps() const { return (int)rows.size(); }
+    float recordedMs(int k, int phase) const { return rows[k].ms[phase]; }
+    double recordedCount(int k, int counter) const { return rows[k].counters[counter]; }
+
+    // State Mutators
+    void count(Counter counter, double value) {
+        if (active) counters[counter] = value;
+    }
+
+private:
+    typedef chrono::steady_clock Clock;
+
+    struct Event {
+        int phase;
+        double start;               // seconds since the profiler was made
+        double duration;
+    };
+    struct Row {
+        float ms[PHASE_COUNT];
+        double counters[COUNTER_COUNT];
+    };
+    struct Sample {
+        double time;                // end of a step
+        double counters[COUNTER_COUNT];
+    };
+
+    bool begin() {
+        if (depth == 0) active = requested.load(memory_order_relaxed);
+        if (!active) return false;
+        childSeconds.push_back(0.0);
+        ++depth;
+        return true;
+    }
+    void end(Phase phase, Clock::time_point start);
+    void endStep();
+
+    atomic<bool> requested;
+    bool active;                    // latched from requested at each step
+    bool recording;
+    bool tracing;
+    int summaryEvery;
+
+    Clock::time_point origin;
+    int depth;
+    vector<double> childSeconds;    // per open scope, time of its children
+
+    double stepSeconds[PHASE_COUNT];
+    double counters[COUNTER_COUNT];
+    long stepCount;
+
+    double totals[PHASE_COUNT];
+    double maxima[PHASE_COUNT];
+    double counterTotals[COUNTER_COUNT];
+    double counterMaxima[COUNTER_COUNT];
+
+    long windowFirst;               // first step of the rolling window
+    double windowSeconds[PHASE_COUNT];
+    double windowCounters[COUNTER_COUNT];
+
+    vector<Row> rows;
+    vector<Event> events;
+    vector<Sample> samples;         // counters for the trace
+};
+
+#ifdef NO_PROFILE
+#define PROFILE_SCOPE(profiler, phase)
+#else
+#define PROFILE_CONCAT2(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT2(a, b)
+#define PROFILE_SCOPE(profiler, phase) \
+    Profiler::Scope PROFILE_CONCAT(profileScope, __LINE__)(profiler, phase)
+#endif
+
+#endif
@@ -0,0 +1,90 @@
+#include "random.h"
+
+#include <cmath>
+
+namespace
+{
+
+const uint32_t PHILOX_M0 = 0xD2511F53u;
+const uint32_t PHILOX_M1 = 0xCD9E8D57u;
+const uint32_t PHILOX_W0 = 0x9E3779B9u;
+const uint32_t PHILOX_W1 = 0xBB67AE85u;
+
+uint64_t splitmix(uint64_t x) {
+    x += 0x9E3779B97F4A7C15ull;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+    return x ^ (x >> 31);
+}
+
+}
+
+Random::Random(uint64_t seed, uint64_t stream) :
+    streamKey(key(seed, stream)),
+    word(0),
+    cachedBlock(~0ull) {
+}
+
+uint64_t Random::key(uint64_t seed, uint64_t stream) {
+    return splitmix(seed ^ splitmix(stream));
+}
+
+void Random::block(uint64_t key, uint64_t counter, uint32_t out[4]) {
+    uint32_t c0 = (uint32_t)counter, c1 = (uint32_t)(counter >> 32), c2 = 0, c3 = 0;
+    uint32_t k0 = (uint32_t)key, k1 = (uint32_t)(key >> 32);
+    for (int round=0; round<10; ++round) {
+        uint64_t p0 = (uint64_t)PHILOX_M0 * c0;
+        uint64_t p1 = (uint64_t)PHILOX_M1 * c2;
+        uint32_t n0 = (uint32_t)(p1 >> 32) ^ c1 ^ k0;
+        uint32_t n2 = (uint32_t)(p0 >> 32) ^ c3 ^ k1;
+        c1 = (uint32_t)p1;
+        c3 = (uint32_t)p0;
+        c0 = n0;
+        c2 = n2;
+        k0 += PHILOX_W0;
+        k1 += PHILOX_W1;
+    }
+    out[0] = c0;
+    out[1] = c1;
+    out[2] = c2;
+    out[3] = c3;
+}
+
+float Random::between(uint32_t bits, float low, float hi) {
+    float v = low + unit(bits) * (hi - low);
+    return v < hi ? v : nextafterf(hi, low);
+}
+
+float Random::uniformAt(uint64_t key, uint64_t index, float low, float hi) {
+    uint32_t words[4];
+    block(key, index >> 2, words);
+    return between(words[index & 3], low, hi);
+}
+
+uint32_t Random::next() {
+    uint64_t b = word >> 2;
+    if (b != cachedBlock) {
+        block(streamKey, b, cache);
+        cachedBlock = b;
+    }
+    return cache[word++ & 3];
+}
+
+void Random::fill(float * out, int n, float low, float hi) {
+    int i = 0;
+    // finish the current block, then whole blocks straight into out
+    while (i < n && (word & 3) != 0) {
+        out[i++] = uniform(low, hi);
+    }
+    uint32_t words[4];
+    for (; i+4 <= n; i+=4) {
+        block(streamKey, word >> 2, words);
+        word += 4;
+        for (int k=0; k<4; ++k) {
+            out[i+k] = between(words[k], low, hi);
+        }
+    }
+    while (i < n) {
+        out[i++] = uniform(low, hi);
+    }
+}
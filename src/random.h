@@ -0,0 +1,54 @@
+#ifndef RANDOM_H
+#define RANDOM_H
+
+#include <cstdint>
+
+using namespace std;
+
+// Counter-based random numbers (Philox4x32-10).
+//
+// Every word is a pure function of a 64-bit stream key and its position
+// in the stream, so streams can be split by purpose (one per droplet, per
+// thread, for the affinity init...) and read at any position without
+// generating what comes before. Nothing is shared between instances, so
+// there is no lock and no ordering dependency between threads.
+class Random {
+public:
+    // Constructor, Destructor
+    explicit Random(uint64_t seed = 0, uint64_t stream = 0);
+    ~Random() {};
+
+    // Static Helpers
+    // key of stream number stream under seed
+    static uint64_t key(uint64_t seed, uint64_t stream);
+    // the four words of block counter of a stream
+    static void block(uint64_t key, uint64_t counter, uint32_t out[4]);
+    // word index of a stream as a float in [low, hi), without a Random
+    static float uniformAt(uint64_t key, uint64_t index, float low, float hi);
+    // 32 random bits to [0, 1)
+    static float unit(uint32_t bits) { return (bits >> 8) * (1.f / 16777216.f); }
+    // 32 random bits to [low, hi); low + unit * (hi - low) alone can round
+    // up to hi, which is then moved to the float just below it
+    static float between(uint32_t bits, float low, float hi);
+    // 32 random bits to an integer in [0, n), n > 0
+    static int below(uint32_t bits, int n) { return (int)(((uint64_t)bits * n) >> 32); }
+
+    // Helper Observers
+    uint64_t position() const { return word; }  // words drawn so far
+
+    // State Mutators
+    uint32_t next();
+    float uniform(float low, float hi) { return between(next(), low, hi); }
+    int uniformInt(int n) { return below(next(), n); }     // in [0, n)
+    // n draws in [low, hi), whole blocks at a time
+    void fill(float * out, int n, float low, float hi);
+    void seek(uint64_t word_) { word = word_; }
+
+private:
+    uint64_t streamKey;
+    uint64_t word;                  // next word of the stream
+    uint64_t cachedBlock;           // block held in cache, ~0 if none
+    uint32_t cache[4];
+};
+
+#endif
@@ -0,0 +1,206 @@
+#include "rasterizer.h"
+
+#include <algorithm>
+#include <climits>
+#include <cmath>
+
+void Rasterizer::rasterize(const DropletStore& droplets, float granularity,
+        Grid2D<float>& heightMap, Grid2D<int>& idMap,
+        TileMask& idTiles, TileMask& wetTiles,
+        ThreadPool& pool, vector<pair<int, int>>& overlaps) {
+    int tiles = idTiles.rows();
+    collectSpheres(droplets, granularity, heightMap.width());
+    fillBins(tiles);
+
+    if ((int)tileOverlaps.size() != tiles*tiles) {
+        tileOverlaps.resize(tiles*tiles);
+    }
+    pool.parallelFor((int)activeTiles.size(), [&](int k) {
+        rasterizeTile(activeTiles[k], tiles, droplets,
+                heightMap, idMap, idTiles, wetTiles);
+    });
+
+    overlaps.clear();
+    for (int t : activeTiles) {
+        overlaps.insert(overlaps.end(), tileOverlaps[t].begin(), tileOverlaps[t].end());
+    }
+}
+
+void Rasterizer::addSpheres(const DropletStore& droplets, int di, float granularity,
+        int gridSize, vector<SubSphere>& out) {
+    const Droplet& d = droplets.shape[di];
+    float m = droplets.mass[di];
+    Span<const uint8_t> chain = d.offsetChain();
+    Span<const float> dist = d.dists();
+
+    Vector3f center = droplets.pos[di];
+    for (int sd_i=0; sd_i<chain.size; ++sd_i) {
+        float r = Droplet::radius(m * dist[sd_i]);
+        center += Droplet::offset(chain[sd_i], granularity);
+
+        SubSphere s;
+        s.stamp = &stampCache.get(center.x(), center.y(), r, granularity, s.cellY, s.cellX);
+        if (s.stamp->empty()) continue;
+        s.slot = di;
+        s.id = droplets.handle[di];
+        s.y0 = max(0, s.cellY + s.stamp->y0);
+        s.y1 = min(gridSize-1, s.cellY + s.stamp->y0 + s.stamp->rows - 1);
+        s.x0 = max(0, s.cellX + s.stamp->x0);
+        s.x1 = min(gridSize-1, s.cellX + s.stamp->x0 + s.stamp->cols - 1);
+        if (s.y0 > s.y1 || s.x0 > s.x1) continue;
+        out.push_back(s);
+    }
+}
+
+void Rasterizer::collectSpheres(const DropletStore& droplets, float granularity, int gridSize) {
+    ++frame;
+    spheres.clear();
+    if (granularity != stampCache.cellSize()) {
+        // cached footprints point into stamps about to be rebuilt
+        cache.clear();
+    }
+    footprints.resize(4 * droplets.size());
+    for (int di=0; di<droplets.size(); ++di) {
+        int first = (int)spheres.size();
+        if (droplets.dead[di]) {
+            // killed this step: leaves no footprint
+        } else if (droplets.asleep[di]) {
+            Footprint& fp = cache[droplets.handle[di]];
+            if (fp.spheres.empty()) {
+                addSpheres(droplets, di, granularity, gridSize, fp.spheres);
+            }
+            fp.frame = frame;
+            for (SubSphere s : fp.spheres) {
+                stampCache.touch(*s.stamp);
+                s.slot = di;
+                spheres.push_back(s);
+            }
+        } else {
+            addSpheres(droplets, di, granularity, gridSize, spheres);
+        }
+
+        int* fpt = &footprints[4*di];
+        fpt[0] = fpt[2] = INT_MAX;
+        fpt[1] = fpt[3] = -1;
+        for (int i=first; i<(int)spheres.size(); ++i) {
+            const SubSphere& s = spheres[i];
+            fpt[0] = min(fpt[0], s.y0 >> TileMask::TILE_SHIFT);
+            fpt[1] = max(fpt[1], s.y1 >> TileMask::TILE_SHIFT);
+            fpt[2] = min(fpt[2], s.x0 >> TileMask::TILE_SHIFT);
+            fpt[3] = max(fpt[3], s.x1 >> TileMask::TILE_SHIFT);
+        }
+    }
+
+    // drop the footprints of droplets that woke up or died
+    for (auto it=cache.begin(); it!=cache.end(); ) {
+        if (it->second.frame != frame) {
+            it = cache.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    // every stamp in spheres and the cache was used this frame
+    stampCache.trim();
+}
+
+void Rasterizer::cellBounds(const DropletStore& droplets, int slot, float granularity,
+        int gridSize, int& y0, int& y1, int& x0, int& x1) {
+    scratch.clear();
+    addSpheres(droplets, slot, granularity, gridSize, scratch);
+    y0 = x0 = INT_MAX;
+    y1 = x1 = -1;
+    for (const SubSphere& s : scratch) {
+        y0 = min(y0, s.y0);
+        y1 = max(y1, s.y1);
+        x0 = min(x0, s.x0);
+        x1 = max(x1, s.x1);
+    }
+}
+
+bool Rasterizer::touches(int slot, const TileMask& tiles) const {
+    const int* fpt = &footprints[4*slot];
+    for (int ty=fpt[0]; ty<=fpt[1]; ++ty) {
+        for (int tx=fpt[2]; tx<=fpt[3]; ++tx) {
+            if (tiles.test(ty, tx)) return true;
+        }
+    }
+    return false;
+}
+
+void Rasterizer::markFootprint(int slot, TileMask& tiles) const {
+    const int* fpt = &footprints[4*slot];
+    for (int ty=fpt[0]; ty<=fpt[1]; ++ty) {
+        for (int tx=fpt[2]; tx<=fpt[3]; ++tx) {
+            tiles.set(ty, tx, true);
+        }
+    }
+}
+
+void Rasterizer::fillBins(int tiles) {
+    // counting sort of (tile, sphere) pairs keeps each bin in droplet order
+    binStart.assign(tiles*tiles + 1, 0);
+    for (const SubSphere& s : spheres) {
+        for (int ty=s.y0 >> TileMask::TILE_SHIFT; ty<=s.y1 >> TileMask::TILE_SHIFT; ++ty) {
+            for (int tx=s.x0 >> TileMask::TILE_SHIFT; tx<=s.x1 >> TileMask::TILE_SHIFT; ++tx) {
+                ++binStart[ty*tiles + tx + 1];
+            }
+        }
+    }
+    activeTiles.clear();
+    for (int t=0; t<tiles*tiles; ++t) {
+        if (binStart[t+1] != 0) activeTiles.push_back(t);
+        binStart[t+1] += binStart[t];
+    }
+
+    binSpheres.resize(binStart[tiles*tiles]);
+    for (int i=0; i<(int)spheres.size(); ++i) {
+        const SubSphere& s = spheres[i];
+        for (int ty=s.y0 >> TileMask::TILE_SHIFT; ty<=s.y1 >> TileMask::TILE_SHIFT; ++ty) {
+            for (int tx=s.x0 >> TileMask::TILE_SHIFT; tx<=s.x1 >> TileMask::TILE_SHIFT; ++tx) {
+                // binStart[t] is used as the fill cursor and restored below
+                binSpheres[binStart[ty*tiles + tx]++] = i;
+            }
+        }
+    }
+    for (int t=tiles*tiles; t>0; --t) {
+        binStart[t] = binStart[t-1];
+    }
+    binStart[0] = 0;
+}
+
+void Rasterizer::rasterizeTile(int t, int tiles, const DropletStore& droplets,
+        Grid2D<float>& heightMap, Grid2D<int>& idMap,
+        TileMask& idTiles, TileMask& wetTiles) {
+    int ty = t / tiles, tx = t % tiles;
+    int ty0 = idTiles.cellBegin(ty), ty1 = idTiles.cellEnd(ty) - 1;
+    int tx0 = idTiles.cellBegin(tx), tx1 = idTiles.cellEnd(tx) - 1;
+    vector<pair<int, int>>& pairs = tileOverlaps[t];
+    pairs.clear();
+
+    for (int b=binStart[t]; b<binStart[t+1]; ++b) {
+        const SubSphere& s = spheres[binSpheres[b]];
+        int x0 = max(s.x0, tx0), x1 = min(s.x1, tx1);
+        for (int y=max(s.y0, ty0); y <= min(s.y1, ty1); ++y) {
+            const float * stamp = s.stamp->row(y - s.cellY);
+            float * height = heightMap[y];
+            int * ids = idMap[y];
+            for (int x=x0; x <= x1; ++x) {
+                // heights are never negative, so a zero stamp cell never wins
+                float h = stamp[x - s.cellX];
+                if (h > height[x]) {
+                    height[x] = h;
+                    if (ids[x] != -1) {
+                        // a droplet over its own hemisphere merges with itself
+                        pair<int, int> overlap(s.slot, droplets.slot(ids[x]));
+                        if (pairs.empty() || pairs.back() != overlap) {
+                            pairs.push_back(overlap);
+                        }
+                    }
+                    ids[x] = s.id;
+                    idTiles.mark(y, x);
+                    wetTiles.mark(y, x);
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,91 @@
+#ifndef RASTERIZER_H
+#define RASTERIZER_H
+
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <vecmath.h>
+
+#include "dropletstore.h"
+#include "grid2d.h"
+#include "stampcache.h"
+#include "threadpool.h"
+#include "tilemask.h"
+
+using namespace std;
+
+// Stamps droplets into the heightMap/idMap in parallel.
+//
+// Every hemisphere of every droplet chain is binned into the TileMask
+// tiles its bounding box touches, then the tiles are rasterized on the
+// thread pool. Each tile sees its hemispheres in droplet order and owns
+// its cells outright, so the maps (and the overlap pairs) come out the
+// same as a serial pass, whatever the thread count. Hemisphere heights
+// come from the StampCache.
+//
+// Sleeping droplets cannot move, so their hemispheres are looked up once
+// when they fall asleep and kept in a cache until they wake or die. A
+// dead droplet's handle may be reused, but a new droplet starts awake, so
+// the stale entry is dropped on the next rasterize before the handle can
+// be cached again.
+class Rasterizer {
+public:
+    // Constructor, Destructor
+    Rasterizer() : frame(0) {};
+    ~Rasterizer() {};
+
+    // Max-blends every droplet into heightMap, writes the winning handle
+    // into idMap and flags the touched tiles. When a droplet takes a cell
+    // over from a droplet (itself included, where its own hemispheres
+    // overlap), the pair of their slots is appended to overlaps (ordered
+    // by tile, then by droplet, without repeating a tile's last pair).
+    void rasterize(const DropletStore& droplets, float granularity,
+            Grid2D<float>& heightMap, Grid2D<int>& idMap,
+            TileMask& idTiles, TileMask& wetTiles,
+            ThreadPool& pool, vector<pair<int, int>>& overlaps);
+
+    // Helper Observers (footprints from the last rasterize, by slot)
+    bool touches(int slot, const TileMask& tiles) const;
+    // cell bounds (inclusive) of every hemisphere of droplet slot where it is now
+    void cellBounds(const DropletStore& droplets, int slot, float granularity,
+            int gridSize, int& y0, int& y1, int& x0, int& x1);
+    void markFootprint(int slot, TileMask& tiles) const;
+    int cachedFootprints() const { return (int)cache.size(); }
+    int cachedStamps() const { return stampCache.size(); }
+
+private:
+    struct SubSphere {
+        int slot;                   // dense droplet slot
+        int id;                     // droplet handle
+        int cellY, cellX;           // cell holding the centre
+        int y0, y1, x0, x1;         // clipped cell bounds (inclusive)
+        const StampCache::Stamp * stamp;
+    };
+
+    struct Footprint {
+        vector<SubSphere> spheres;
+        unsigned long frame;        // last rasterize that used it
+    };
+
+    void addSpheres(const DropletStore& droplets, int di, float granularity,
+            int gridSize, vector<SubSphere>& out);
+    void collectSpheres(const DropletStore& droplets, float granularity, int gridSize);
+    void fillBins(int tiles);
+    void rasterizeTile(int t, int tiles, const DropletStore& droplets,
+            Grid2D<float>& heightMap, Grid2D<int>& idMap,
+            TileMask& idTiles, TileMask& wetTiles);
+
+    vector<SubSphere> spheres;
+    vector<int> binStart;           // spheres of tile t: binStart[t]..binStart[t+1]-1
+    vector<int> binSpheres;
+    vector<int> activeTiles;        // tiles with a non-empty bin
+    vector<vector<pair<int, int>>> tileOverlaps;
+    vector<int> footprints;         // 4 per slot: ty0, ty1, tx0, tx1
+    vector<SubSphere> scratch;      // for cellBounds
+
+    StampCache stampCache;
+    unordered_map<int, Footprint> cache;    // sleeping droplets, by handle
+    unsigned long frame;            // rasterize calls so far
+};
+
+#endif
@@ -0,0 +1,127 @@
+// Turns a heightmap sequence file (a3_headless -Q) back into the numbered
+// PNG (or raw) frames the renderer reads, exactly as WindowSystem would
+// have exported them, or prints what the file holds.
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+
+#include "exporter.h"
+#include "exportpolicy.h"
+#include "heightsequence.h"
+
+using namespace std;
+
+namespace
+{
+
+void usage(const char* prog)
+{
+    printf("Usage: %s [options] <file.a3seq>\n", prog);
+    printf("       -o <dir>        output directory (default ../Output)\n");
+    printf("       -p <prefix>     frame file prefix (default heightmap)\n");
+    printf("       -w <digits>     frame number width (default 4)\n");
+    printf("       -f <frame>      first frame to write, from 1 (default 1)\n");
+    printf("       -l <frame>      last frame to write (default the last)\n");
+    printf("       -S <scale>      PNG value per unit of height (default 20)\n");
+    printf("       -b <8|16>       PNG bits per height sample (default 8)\n");
+    printf("       -z <d|f|s>      PNG compression: default, fast or store only\n");
+    printf("       -R              write unscaled float32 .raw frames, not PNG\n");
+    printf("       -E <encoders>   encoder threads, 0 = all cores (default)\n");
+    printf("       -i              only print the header and frame index\n");
+    printf("\n");
+    printf("Try  : %s -o ../Output ../Output/heightmap.a3seq\n", prog);
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    const char* input = nullptr;
+    ExportPolicy policy;
+    int first = 1;
+    int last = 0;
+    float scale = 20.f;
+    int encoders = 0;
+    bool info = false;
+
+    for (int i=1; i<argc; ++i) {
+        const char* flag = argv[i];
+        bool hasValue = i+1 < argc;
+        if (!strcmp(flag, "-o") && hasValue) policy.directory = argv[++i];
+        else if (!strcmp(flag, "-p") && hasValue) policy.prefix = argv[++i];
+        else if (!strcmp(flag, "-w") && hasValue) policy.digits = atoi(argv[++i]);
+        else if (!strcmp(flag, "-f") && hasValue) first = atoi(argv[++i]);
+        else if (!strcmp(flag, "-l") && hasValue) last = atoi(argv[++i]);
+        else if (!strcmp(flag, "-S") && hasValue) scale = (float)atof(argv[++i]);
+        else if (!strcmp(flag, "-b") && hasValue) policy.png.bitDepth = atoi(argv[++i]);
+        else if (!strcmp(flag, "-z") && hasValue) {
+            switch (argv[++i][0]) {
+            case 'd': policy.png.compression = PngOptions::DEFAULT; break;
+            case 'f': policy.png.compression = PngOptions::FAST; break;
+            case 's': policy.png.compression = PngOptions::STORE; break;
+            default: usage(argv[0]); return -1;
+            }
+        }
+        else if (!strcmp(flag, "-R")) policy.sink = ExportPolicy::RAW;
+        else if (!strcmp(flag, "-E") && hasValue) encoders = atoi(argv[++i]);
+        else if (!strcmp(flag, "-i")) info = true;
+        else if (flag[0] != '-' && !input) input = flag;
+        else {
+            usage(argv[0]);
+            return -1;
+        }
+    }
+    if (!input || (policy.png.bitDepth != 8 && policy.png.bitDepth != 16)) {
+        usage(argv[0]);
+        return -1;
+    }
+
+    HeightSequenceReader reader;
+    if (!reader.open(input)) {
+        printf("Cannot read %s as a heightmap sequence\n", input);
+        return -1;
+    }
+    printf("%s: %d frames of %d x %d, %s, %.1f MB\n", input, reader.frames(),
+            reader.width(), reader.height(), HeightSequence::encodingName(reader.encoding()),
+            reader.fileBytes() / 1e6);
+    if (info) {
+        for (int f=0; f<reader.frames(); ++f) {
+            printf("%6d  t = %9.4f s  %10zu bytes%s\n", f+1, reader.time(f), reader.frameBytes(f),
+                    reader.encoding() == HeightSequence::TILE_DELTA && reader.isKeyFrame(f) ?
+                    "  key" : "");
+        }
+        return 0;
+    }
+
+    last = last > 0 ? min(last, reader.frames()) : reader.frames();
+    first = max(first, 1);
+    if (encoders <= 0) {
+        encoders = max(1, (int)thread::hardware_concurrency());
+    }
+    HeightMapExporter exporter(encoders, encoders + 1, HeightMapExporter::BLOCK);
+    HeightMapExporter::Format format = policy.sink == ExportPolicy::RAW ?
+        HeightMapExporter::RAW : HeightMapExporter::PNG;
+
+    Grid2D<float> heights;
+    for (int f=first; f<=last; ++f) {
+        // delta frames pick up from the frame decoded last
+        if (!reader.frame(f-1, heights, f == first ? -1 : f-2)) {
+            printf("Frame %d is corrupt\n", f);
+            return -1;
+        }
+        // flipped like WindowSystem's own exports
+        exporter.submit(heights.view(), policy.filename(f), scale, true, format, policy.png);
+    }
+    exporter.flush();
+    if (exporter.failed()) {
+        printf("%d frames could not be written to %s\n", exporter.failed(),
+                policy.directory.c_str());
+        return -1;
+    }
+    printf("wrote frames %d to %d to %s\n", first, last, policy.directory.c_str());
+    return 0;
+}
@@ -0,0 +1,122 @@
+#include "simloop.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+
+#include "timestepper.h"
+#include "windowsystem.h"
+
+SimLoop::SimLoop(WindowSystem* system_, TimeStepper* stepper_, float h_,
+        int maxStepsPerTick_) :
+    system(system_),
+    stepper(stepper_),
+    h(h_),
+    maxStepsPerTick(max(1, maxStepsPerTick_)),
+    running(false),
+    back(0),
+    front(1),
+    middle(2),
+    published(false),
+    wallMicros(0),
+    simulatedSteps(0),
+    droppedMicros(0),
+    overBudget(0) {
+}
+
+SimLoop::~SimLoop() {
+    stop();
+}
+
+void SimLoop::start() {
+    if (running) {
+        return;
+    }
+    running = true;
+    worker = thread(&SimLoop::run, this);
+}
+
+void SimLoop::stop() {
+    running = false;
+    if (worker.joinable()) {
+        worker.join();
+    }
+}
+
+const SimLoop::Snapshot* SimLoop::acquire() {
+    if (middle.load(memory_order_relaxed) & FRESH) {
+        front = middle.exchange(front, memory_order_acq_rel) & ~FRESH;
+        published = true;
+    }
+    return published ? &buffers[front] : nullptr;
+}
+
+double SimLoop::wallSeconds() const {
+    return wallMicros * 1e-6;
+}
+
+double SimLoop::simulatedSeconds() const {
+    return simulatedSteps * (double)h;
+}
+
+double SimLoop::droppedSeconds() const {
+    return droppedMicros * 1e-6;
+}
+
+long SimLoop::overBudgetTicks() const {
+    return overBudget;
+}
+
+void SimLoop::printReport() const {
+    double wall = wallSeconds();
+    double simulated = simulatedSeconds();
+    printf("Simulated %.2fs in %.2fs wall (%.0f%% speed), dropped %.2fs over %ld ticks\n",
+            simulated, wall, wall > 0.0 ? 100.0 * simulated / wall : 100.0,
+            droppedSeconds(), overBudgetTicks());
+}
+
+void SimLoop::run() {
+    typedef chrono::steady_clock Clock;
+    Clock::time_point start = Clock::now();
+    Clock::time_point last = start;
+    double owed = 0.0;              // wall seconds not simulated yet
+    double dropped = 0.0;
+
+    while (running) {
+        Clock::time_point now = Clock::now();
+        owed += chrono::duration<double>(now - last).count();
+        last = now;
+
+        int steps = 0;
+        while (owed >= h && steps < maxStepsPerTick) {
+            PROFILE_SCOPE(system->profiler(), Profiler::INTEGRATE);
+            stepper->takeStep(system, h);
+            owed -= h;
+            ++steps;
+        }
+        if (owed >= h) {
+            // over budget: give up on the backlog rather than chase it
+            dropped += owed;
+            owed = 0.0;
+            ++overBudget;
+        }
+
+        simulatedSteps += steps;
+        wallMicros = (long)(chrono::duration<double>(Clock::now() - start).count() * 1e6);
+        droppedMicros = (long)(dropped * 1e6);
+
+        if (steps > 0) {
+            publish();
+        } else {
+            this_thread::sleep_for(chrono::duration<double>(h - owed));
+        }
+    }
+}
+
+void SimLoop::publish() {
+    Snapshot& snapshot = buffers[back];
+    system->copyHeightMap(snapshot.heights);
+    snapshot.simTime = simulatedSeconds();
+    snapshot.steps = simulatedSteps;
+    back = middle.exchange(back | FRESH, memory_order_acq_rel) & ~FRESH;
+}
@@ -0,0 +1,78 @@
+#ifndef SIMLOOP_H
+#define SIMLOOP_H
+
+#include <atomic>
+#include <thread>
+
+#include "grid2d.h"
+
+using namespace std;
+
+class TimeStepper;
+class WindowSystem;
+
+// Fixed-timestep scheduler that runs the simulation on its own thread.
+//
+// Wall time is accumulated and paid off in steps of h. A tick takes at
+// most maxStepsPerTick steps; whatever is still owed after that is
+// dropped, so a scene that cannot keep up runs in slow motion (dilated
+// time) instead of falling further and further behind. After each tick
+// the heightmap is published through a lock-free triple buffer, and the
+// render thread picks up the latest one with acquire().
+class SimLoop {
+public:
+    struct Snapshot {
+        Grid2D<float> heights;
+        double simTime;             // simulated seconds at this snapshot
+        long steps;                 // steps taken at this snapshot
+    };
+
+    // Constructor, Destructor
+    SimLoop(WindowSystem* system_, TimeStepper* stepper_, float h_,
+            int maxStepsPerTick_ = 8);
+    ~SimLoop();                     // stops the thread
+
+    // State Mutators
+    void start();
+    void stop();                    // returns once the current tick is done
+
+    // Render thread only: the newest published snapshot, or nullptr
+    // before the first one. Valid until the next acquire().
+    const Snapshot* acquire();
+
+    // Helper Observers (safe from any thread)
+    double wallSeconds() const;
+    double simulatedSeconds() const;
+    double droppedSeconds() const;  // wall time never simulated
+    long overBudgetTicks() const;   // ticks that hit maxStepsPerTick
+    void printReport() const;
+
+private:
+    void run();
+    void publish();
+
+    static const int FRESH = 4;     // set in middle when it holds a new snapshot
+
+    WindowSystem* system;
+    TimeStepper* stepper;
+    float h;
+    int maxStepsPerTick;
+
+    thread worker;
+    atomic<bool> running;
+
+    // triple buffer: the sim thread owns back, the render thread owns
+    // front, and the two swap through middle
+    Snapshot buffers[3];
+    int back;
+    int front;
+    atomic<int> middle;
+    bool published;                 // render thread has seen a snapshot
+
+    atomic<long> wallMicros;
+    atomic<long> simulatedSteps;
+    atomic<long> droppedMicros;
+    atomic<long> overBudget;
+};
+
+#endif
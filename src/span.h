@@ -0,0 +1,25 @@
+#ifndef SPAN_H
+#define SPAN_H
+
+using namespace std;
+
+// Non-owning view of size contiguous elements (a C++11 stand-in for
+// std::span). Nothing is bounds checked.
+template <typename T>
+struct Span {
+    T * data;
+    int size;
+
+    Span() : data(nullptr), size(0) {}
+    Span(T * data_, int size_) : data(data_), size(size_) {}
+    // a span of T converts to a span of const T
+    template <typename U>
+    Span(const Span<U>& s) : data(s.data), size(s.size) {}
+
+    T& operator[](int i) const { return data[i]; }
+    T * begin() const { return data; }
+    T * end() const { return data + size; }
+    bool empty() const { return size == 0; }
+};
+
+#endif
@@ -0,0 +1,95 @@
+#include "stampcache.h"
+
+#include <algorithm>
+#include <cmath>
+
+const StampCache::Stamp& StampCache::get(float cx, float cy, float r, float granularity_,
+        int& cellY, int& cellX) {
+    if (granularity_ != granularity) {
+        stamps.clear();
+        granularity = granularity_;
+    }
+    float gy = cy / granularity;
+    float gx = cx / granularity;
+    cellY = (int)floor(gy);
+    cellX = (int)floor(gx);
+    // nearest offset step, so a centre at the middle of a cell stays there
+    int oy = (int)lround((gy - cellY) * OFFSET_STEPS);
+    int ox = (int)lround((gx - cellX) * OFFSET_STEPS);
+    if (oy == OFFSET_STEPS) {
+        oy = 0;
+        ++cellY;
+    }
+    if (ox == OFFSET_STEPS) {
+        ox = 0;
+        ++cellX;
+    }
+    int rq = (int)lround(r / granularity * RADIUS_STEPS);
+
+    uint64_t key = (uint64_t)rq << 32 | (uint64_t)oy << 16 | (uint64_t)ox;
+    auto it = stamps.find(key);
+    if (it == stamps.end()) {
+        it = stamps.insert(make_pair(key, Stamp())).first;
+        build(it->second, rq, oy, ox);
+    }
+    it->second.used = period;
+    return it->second;
+}
+
+void StampCache::trim() {
+    if ((int)stamps.size() > MAX_STAMPS) {
+        // oldest first; evict down to 3/4 of the cap so this does not
+        // run again next period
+        vector<pair<unsigned long, uint64_t>> idle;
+        for (const auto& kv : stamps) {
+            if (kv.second.used != period) {
+                idle.push_back(make_pair(kv.second.used, kv.first));
+            }
+        }
+        size_t excess = stamps.size() - MAX_STAMPS * 3 / 4;
+        size_t n = min(excess, idle.size());
+        partial_sort(idle.begin(), idle.begin() + n, idle.end());
+        for (size_t i=0; i<n; ++i) {
+            stamps.erase(idle[i].second);
+        }
+    }
+    ++period;
+}
+
+void StampCache::build(Stamp& st, int rq, int oy, int ox) const {
+    // in cell units, with the centre's cell at the origin
+    float r = (float)rq / RADIUS_STEPS;
+    float fy = (float)oy / OFFSET_STEPS;
+    float fx = (float)ox / OFFSET_STEPS;
+    int reach = (int)ceil(r) + 1;
+
+    // rows and columns where some cell centre is inside the circle
+    int y0 = reach, y1 = -reach - 1, x0 = reach, x1 = -reach - 1;
+    for (int dy=-reach; dy<=reach; ++dy) {
+        float ry = dy + 0.5f - fy;
+        for (int dx=-reach; dx<=reach; ++dx) {
+            float rx = dx + 0.5f - fx;
+            if (r*r - (rx*rx + ry*ry) > 0) {
+                y0 = min(y0, dy);
+                y1 = max(y1, dy);
+                x0 = min(x0, dx);
+                x1 = max(x1, dx);
+            }
+        }
+    }
+    st.y0 = y0;
+    st.x0 = x0;
+    st.rows = max(0, y1 - y0 + 1);
+    st.cols = max(0, x1 - x0 + 1);
+    st.heights.assign(st.rows * st.cols, 0.f);
+
+    float * h = st.heights.data();
+    for (int dy=y0; dy<=y1; ++dy) {
+        float ry = dy + 0.5f - fy;
+        for (int dx=x0; dx<=x1; ++dx) {
+            float rx = dx + 0.5f - fx;
+            float heightSq = r*r - (rx*rx + ry*ry);
+            *h++ = heightSq > 0 ? granularity * sqrt(heightSq) : 0.f;
+        }
+    }
+}
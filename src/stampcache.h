@@ -0,0 +1,69 @@
+#ifndef STAMPCACHE_H
+#define STAMPCACHE_H
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+using namespace std;
+
+// Precomputed hemisphere height kernels ("stamps").
+//
+// A hemisphere is rasterized by max-blending the stamp for its radius
+// and its centre's position inside its cell. Both are rounded to the
+// nearest step (radius to 1/RADIUS_STEPS of a cell, centre to
+// 1/OFFSET_STEPS, a centre rounding up to the next cell moving there), so
+// the few stamps in use are computed once and rasterizing needs no sqrt.
+// The quantization moves a hemisphere by at most half an offset step.
+//
+// Radii and offsets span tens of thousands of keys, but a scene uses a
+// few hundred of them at a time. Past MAX_STAMPS, trim() evicts the
+// stamps used longest ago, never one used since the previous trim.
+class StampCache {
+public:
+    static const int OFFSET_STEPS = 8;      // centre positions per cell side
+    static const int RADIUS_STEPS = 16;     // radii per cell
+    static const int MAX_STAMPS = 4096;     // trimmed past this many
+
+    // Heights of one hemisphere, in world units, over the cells where it
+    // is above zero. Rows and columns are relative to the centre's cell.
+    struct Stamp {
+        int y0, x0;                 // first row and column
+        int rows, cols;
+        vector<float> heights;      // rows x cols, row major
+        mutable unsigned long used; // last trim period it was used in
+
+        bool empty() const { return rows == 0; }
+        const float * row(int dy) const { return heights.data() + (dy - y0) * cols - x0; }
+    };
+
+    // Constructor, Destructor
+    StampCache() : granularity(0.f), period(0) {};
+    ~StampCache() {};
+
+    // Helper Observers
+    int size() const { return (int)stamps.size(); }
+    float cellSize() const { return granularity; }
+
+    // State Mutators
+    // stamp of a hemisphere of radius r centred at (cx, cy), and the cell
+    // (cellY, cellX) holding the rounded centre; references stay valid
+    // until the stamp is trimmed, or the granularity changes
+    const Stamp& get(float cx, float cy, float r, float granularity_,
+            int& cellY, int& cellX);
+    // marks a stamp got earlier as still in use, so trim keeps it
+    void touch(const Stamp& st) const { st.used = period; }
+    // once past MAX_STAMPS, evicts the least recently used stamps that
+    // were neither got nor touched since the last trim
+    void trim();
+    void clear() { stamps.clear(); }
+
+private:
+    void build(Stamp& st, int rq, int oy, int ox) const;
+
+    float granularity;              // cell width the stamps are built for
+    unsigned long period;           // trim calls so far
+    unordered_map<uint64_t, Stamp> stamps;  // by quantized (radius, oy, ox)
+};
+
+#endif
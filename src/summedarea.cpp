@@ -0,0 +1,66 @@
+#include "summedarea.h"
+
+#include <algorithm>
+
+double SummedAreaTable::sum(int ya, int xa, int yb, int xb) const {
+    ya = max(ya - y0, 0);
+    xa = max(xa - x0, 0);
+    yb = min(yb - y0, rows);
+    xb = min(xb - x0, cols);
+    if (ya >= yb || xa >= xb) return 0.0;
+    return entry(yb)[xb] - entry(ya)[xb] - entry(yb)[xa] + entry(ya)[xa];
+}
+
+void SummedAreaTable::reshape(int y0_, int x0_, int rows_, int cols_) {
+    y0 = y0_;
+    x0 = x0_;
+    rows = rows_;
+    cols = cols_;
+    table.resize((size_t)(rows+1) * (cols+1));
+    fill(entry(0), entry(0) + cols+1, 0.0);
+}
+
+void SummedAreaTable::accumulateRows() {
+    // rows hold their own prefix sums; adding the row above completes the
+    // table, and that loop has no carried dependency so it vectorizes
+    for (int y=1; y<=rows; ++y) {
+        const double * above = entry(y-1);
+        double * row = entry(y);
+        for (int x=1; x<=cols; ++x) {
+            row[x] += above[x];
+        }
+    }
+}
+
+void SummedAreaTable::build(const GridView<const float>& values,
+        int y0_, int x0_, int rows_, int cols_) {
+    reshape(y0_, x0_, rows_, cols_);
+    for (int y=0; y<rows; ++y) {
+        const float * src = values[y0 + y] + x0;
+        double * row = entry(y+1);
+        double running = 0.0;
+        row[0] = 0.0;
+        for (int x=0; x<cols; ++x) {
+            running += src[x];
+            row[x+1] = running;
+        }
+    }
+    accumulateRows();
+}
+
+void SummedAreaTable::build(const GridView<const float>& values, const GridView<const int>& ids,
+        int id, int y0_, int x0_, int rows_, int cols_) {
+    reshape(y0_, x0_, rows_, cols_);
+    for (int y=0; y<rows; ++y) {
+        const float * src = values[y0 + y] + x0;
+        const int * owner = ids[y0 + y] + x0;
+        double * row = entry(y+1);
+        double running = 0.0;
+        row[0] = 0.0;
+        for (int x=0; x<cols; ++x) {
+            if (owner[x] == id) running += src[x];
+            row[x+1] = running;
+        }
+    }
+    accumulateRows();
+}
@@ -0,0 +1,48 @@
+#ifndef SUMMEDAREA_H
+#define SUMMEDAREA_H
+
+#include <vector>
+
+#include "grid2d.h"
+
+using namespace std;
+
+// Summed-area table (integral image) over a rectangle of a float grid.
+//
+// Entries are kept in double so window sums stay accurate however far
+// the window is from the table origin. Any rectangle sum is four lookups.
+class SummedAreaTable {
+public:
+    // Constructor, Destructor
+    SummedAreaTable() : y0(0), x0(0), rows(0), cols(0) {};
+    ~SummedAreaTable() {};
+
+    // Helper Observers
+    bool empty() const { return rows == 0 || cols == 0; }
+    // sum over cells [ya, yb) x [xa, xb) in grid coordinates; the parts
+    // outside the table count as zero
+    double sum(int ya, int xa, int yb, int xb) const;
+
+    // State Mutators
+    // cells [y0_, y0_+rows_) x [x0_, x0_+cols_) of values
+    void build(const GridView<const float>& values, int y0_, int x0_, int rows_, int cols_);
+    // the same, counting only cells whose ids entry equals id
+    void build(const GridView<const float>& values, const GridView<const int>& ids,
+            int id, int y0_, int x0_, int rows_, int cols_);
+    void clear() { rows = cols = 0; }
+
+private:
+    void reshape(int y0_, int x0_, int rows_, int cols_);
+    void accumulateRows();
+
+    int y0, x0;                     // grid cell of table entry (1, 1)
+    int rows, cols;
+    // (rows+1) x (cols+1), first row and column zero; a plain vector so
+    // rebuilding at a different shape reuses the block
+    vector<double> table;
+
+    double * entry(int y) { return &table[(size_t)y * (cols+1)]; }
+    const double * entry(int y) const { return &table[(size_t)y * (cols+1)]; }
+};
+
+#endif
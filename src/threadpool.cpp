@@ -0,0 +1,76 @@
+#include "threadpool.h"
+
+#include <algorithm>
+
+ThreadPool::ThreadPool(int threads) :
+    job(nullptr),
+    jobSize(0),
+    nextIndex(0),
+    busyWorkers(0),
+    generation(0),
+    stopping(false) {
+
+    if (threads <= 0) {
+        threads = max(1, (int)thread::hardware_concurrency());
+    }
+    for (int i=1; i<threads; ++i) {
+        workers.push_back(thread(&ThreadPool::workerLoop, this));
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        lock_guard<mutex> guard(lock);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (thread& t : workers) {
+        t.join();
+    }
+}
+
+void ThreadPool::parallelFor(int n, const function<void(int)>& body) {
+    if (n <= 0) return;
+    if (workers.empty() || n == 1) {
+        for (int i=0; i<n; ++i) body(i);
+        return;
+    }
+    {
+        lock_guard<mutex> guard(lock);
+        job = &body;
+        jobSize = n;
+        nextIndex = 0;
+        busyWorkers = (int)workers.size();
+        ++generation;
+    }
+    wake.notify_all();
+    runJob();
+
+    unique_lock<mutex> guard(lock);
+    done.wait(guard, [this] { return busyWorkers == 0; });
+    job = nullptr;
+}
+
+void ThreadPool::runJob() {
+    for (int i = nextIndex++; i < jobSize; i = nextIndex++) {
+        (*job)(i);
+    }
+}
+
+void ThreadPool::workerLoop() {
+    unsigned long seen = 0;
+    while (true) {
+        {
+            unique_lock<mutex> guard(lock);
+            wake.wait(guard, [&] { return stopping || generation != seen; });
+            if (stopping) return;
+            seen = generation;
+        }
+        runJob();
+        {
+            lock_guard<mutex> guard(lock);
+            --busyWorkers;
+        }
+        done.notify_one();
+    }
+}
@@ -0,0 +1,50 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+// Fixed set of worker threads for data-parallel loops.
+//
+// parallelFor hands out loop indices one at a time to the workers and to
+// the calling thread, and returns once every index has run. Work is never
+// split by thread count, so callers that keep per-index outputs get the
+// same result however many threads there are.
+class ThreadPool {
+public:
+    // Constructor, Destructor
+    // threads counts the caller; 0 picks one per hardware thread, and 1
+    // runs every loop inline on the caller.
+    explicit ThreadPool(int threads = 0);
+    ~ThreadPool();
+
+    // Helper Observers
+    int size() const { return (int)workers.size() + 1; }
+
+    // Runs body(i) for every i in [0, n).
+    void parallelFor(int n, const function<void(int)>& body);
+
+private:
+    void workerLoop();
+    void runJob();
+
+    vector<thread> workers;
+    mutex lock;
+    condition_variable wake;        // workers wait here for a new job
+    condition_variable done;        // the caller waits here for the workers
+
+    const function<void(int)> * job;
+    int jobSize;
+    atomic<int> nextIndex;
+    int busyWorkers;
+    unsigned long generation;       // bumped for every job
+    bool stopping;
+};
+
+#endif
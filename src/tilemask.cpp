@@ -0,0 +1,70 @@
+#include "tilemask.h"
+
+void TileMask::resize(int gridSize_) {
+    gridSize = gridSize_;
+    tiles = (gridSize + TILE_SIZE - 1) >> TILE_SHIFT;
+    flags.assign(tiles*tiles, 0);
+}
+
+void TileMask::clear() {
+    fill(flags.begin(), flags.end(), 0);
+}
+
+bool TileMask::any() const {
+    for (uint8_t f : flags) {
+        if (f) return true;
+    }
+    return false;
+}
+
+int TileMask::cellCount() const {
+    int n = 0;
+    for (int ty=0; ty<tiles; ++ty) {
+        for (int tx=0; tx<tiles; ++tx) {
+            if (test(ty, tx)) {
+                n += (cellEnd(ty) - cellBegin(ty)) * (cellEnd(tx) - cellBegin(tx));
+            }
+        }
+    }
+    return n;
+}
+
+bool TileMask::rowSpan(int ty, int& tx0, int& tx1) const {
+    const uint8_t * row = &flags[ty*tiles];
+    tx0 = 0;
+    while (tx0 < tiles && !row[tx0]) ++tx0;
+    if (tx0 == tiles) return false;
+    tx1 = tiles;
+    while (!row[tx1-1]) --tx1;
+    return true;
+}
+
+void TileMask::dilate(TileMask& out, int by) const {
+    if (out.gridSize != gridSize) {
+        out.resize(gridSize);
+    } else {
+        out.clear();
+    }
+    for (int ty=0; ty<tiles; ++ty) {
+        for (int tx=0; tx<tiles; ++tx) {
+            if (!test(ty, tx)) continue;
+            for (int oy=max(0, ty-by); oy<=min(tiles-1, ty+by); ++oy) {
+                for (int ox=max(0, tx-by); ox<=min(tiles-1, tx+by); ++ox) {
+                    out.flags[oy*tiles + ox] = 1;
+                }
+            }
+        }
+    }
+}
+
+void TileMask::add(const TileMask& other) {
+    for (size_t i=0; i<flags.size(); ++i) {
+        flags[i] |= other.flags[i];
+    }
+}
+
+void TileMask::differ(const TileMask& a, const TileMask& b) {
+    for (size_t i=0; i<flags.size(); ++i) {
+        flags[i] = a.flags[i] != b.flags[i];
+    }
+}
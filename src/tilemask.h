@@ -0,0 +1,51 @@
+#ifndef TILEMASK_H
+#define TILEMASK_H
+
+#include <algorithm>
+#include <vector>
+#include <cstdint>
+
+using namespace std;
+
+// One flag per TILE_SIZE x TILE_SIZE block of a square grid.
+//
+// The grid passes in WindowSystem use these to skip blocks that are known
+// to be empty (dry heightMap, unused idMap), so their cost follows the wet
+// area of the window rather than its full size.
+class TileMask {
+public:
+    static const int TILE_SHIFT = 5;
+    static const int TILE_SIZE = 1 << TILE_SHIFT;
+
+    // Constructor, Destructor
+    TileMask() : gridSize(0), tiles(0) {};
+    ~TileMask() {};
+
+    // Helper Observers
+    int rows() const { return tiles; }  // tiles per side
+    bool test(int ty, int tx) const { return flags[ty*tiles + tx] != 0; }
+    bool any() const;
+    int cellCount() const;              // cells in flagged tiles
+    // [tx0, tx1) spanning every flagged tile in tile row ty, false if none
+    bool rowSpan(int ty, int& tx0, int& tx1) const;
+    // cell range [begin, end) covered by tile row/column t
+    int cellBegin(int t) const { return t << TILE_SHIFT; }
+    int cellEnd(int t) const { return min(gridSize, (t+1) << TILE_SHIFT); }
+
+    // State Mutators
+    void resize(int gridSize_);
+    void clear();
+    void mark(int y, int x) { flags[(y >> TILE_SHIFT)*tiles + (x >> TILE_SHIFT)] = 1; }
+    void set(int ty, int tx, bool on) { flags[ty*tiles + tx] = on; }
+    void dilate(TileMask& out, int by=1) const; // out = this grown by `by` tiles
+    void add(const TileMask& other);    // flags every tile other flags (same grid)
+    // flags the tiles flagged in a or b but not both (same grid)
+    void differ(const TileMask& a, const TileMask& b);
+
+private:
+    int gridSize;                   // cells per side of the masked grid
+    int tiles;                      // tiles per side
+    vector<uint8_t> flags;
+};
+
+#endif
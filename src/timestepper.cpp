@@ -1,12 +1,225 @@
 #include "timestepper.h"
 
+#include <algorithm>
+#include <cmath>
 #include <cstdio>
 
 using namespace std;
 
+namespace
+{
+
+// out = x + a * f
+void axpy(vector<Vector3f>& out, const vector<Vector3f>& x, float a, const vector<Vector3f>& f) {
+    out.resize(x.size());
+    for (int i=0; i<(int)x.size(); ++i) {
+        out[i] = x[i] + f[i] * a;
+    }
+}
+
+// Dormand-Prince 5(4) tableau
+const float DP_A[7][6] = {
+    { 0.f },
+    { 1.f/5 },
+    { 3.f/40, 9.f/40 },
+    { 44.f/45, -56.f/15, 32.f/9 },
+    { 19372.f/6561, -25360.f/2187, 64448.f/6561, -212.f/729 },
+    { 9017.f/3168, -355.f/33, 46732.f/5247, 49.f/176, -5103.f/18656 },
+    { 35.f/384, 0.f, 500.f/1113, 125.f/192, -2187.f/6784, 11.f/84 }
+};
+// fifth order weights minus the embedded fourth order ones
+const float DP_E[7] = {
+    71.f/57600, 0.f, -71.f/16695, 71.f/1920, -17253.f/339200, 22.f/525, -1.f/40
+};
+
+}
+
+void ForwardEuler::takeStep(ParticleSystem* particleSystem, float stepSize) {
+    particleSystem->getState(x0);
+    particleSystem->evalF(x0, k1);
+    axpy(xt, x0, stepSize, k1);
+    particleSystem->setState(xt);
+    particleSystem->postStep(stepSize);
+}
+
+void SemiImplicitEuler::takeStep(ParticleSystem* particleSystem, float stepSize) {
+    particleSystem->getState(x0);
+    particleSystem->evalF(x0, k1);
+    for (int i=0; i+1<(int)x0.size(); i+=2) {
+        x0[i+1] += k1[i+1] * stepSize;
+        x0[i] += x0[i+1] * stepSize;
+    }
+    particleSystem->setState(x0);
+    particleSystem->postStep(stepSize);
+}
+
+void Midpoint::takeStep(ParticleSystem* particleSystem, float stepSize) {
+    particleSystem->getState(x0);
+    particleSystem->evalF(x0, k1);
+    axpy(xt, x0, stepSize / 2, k1);
+    particleSystem->evalF(xt, k1);
+    axpy(xt, x0, stepSize, k1);
+    particleSystem->setState(xt);
+    particleSystem->postStep(stepSize);
+}
+
 void RK4::takeStep(ParticleSystem* particleSystem, float stepSize) {
+    float h = stepSize;
+    particleSystem->getState(x0);
+    particleSystem->evalF(x0, k1);
+    axpy(xt, x0, h / 2, k1);
+    particleSystem->evalF(xt, k2);
+    axpy(xt, x0, h / 2, k2);
+    particleSystem->evalF(xt, k3);
+    axpy(xt, x0, h, k3);
+    particleSystem->evalF(xt, k4);
 
-    particleSystem->takeStep(stepSize);
+    for (int i=0; i<(int)x0.size(); ++i) {
+        xt[i] = x0[i] + (k1[i] + 2.f * k2[i] + 2.f * k3[i] + k4[i]) * (h / 6);
+    }
+    particleSystem->setState(xt);
+    particleSystem->postStep(stepSize);
+}
+
+RK45::RK45(float tolerance_, int maxSubsteps_) :
+    tolerance(tolerance_),
+    maxSubsteps(max(1, maxSubsteps_)),
+    dtGuess(0.f),
+    lastSubsteps(0),
+    lastRejected(0) {
+}
 
+float RK45::error(const vector<Vector3f>& x, const vector<Vector3f>& err) const {
+    float worst = 0.f;
+    for (int i=0; i<(int)x.size(); ++i) {
+        for (int c=0; c<3; ++c) {
+            float scale = tolerance * (1.f + fabs(x[i][c]));
+            worst = max(worst, fabs(err[i][c]) / scale);
+        }
+    }
+    return worst;
 }
 
+void RK45::takeStep(ParticleSystem* particleSystem, float stepSize) {
+    particleSystem->getState(x0);
+    int n = (int)x0.size();
+
+    float minDt = stepSize / maxSubsteps;
+    float dt = dtGuess > 0.f ? min(dtGuess, stepSize) : stepSize;
+    float remaining = stepSize;
+    lastSubsteps = 0;
+    lastRejected = 0;
+
+    bool done = false;
+    while (!done) {
+        bool last = dt >= remaining;
+        if (last) {
+            dt = remaining;
+        }
+
+        // stages; the seventh is evaluated at the fifth order solution
+        particleSystem->evalF(x0, k[0]);
+        for (int s=1; s<7; ++s) {
+            xt.resize(n);
+            for (int i=0; i<n; ++i) {
+                Vector3f sum = k[0][i] * DP_A[s][0];
+                for (int j=1; j<s; ++j) {
+                    sum += k[j][i] * DP_A[s][j];
+                }
+                xt[i] = x0[i] + sum * dt;
+            }
+            if (s == 6) {
+                x5.swap(xt);
+                particleSystem->evalF(x5, k[s]);
+            } else {
+                particleSystem->evalF(xt, k[s]);
+            }
+        }
+        err.resize(n);
+        for (int i=0; i<n; ++i) {
+            Vector3f sum = k[0][i] * DP_E[0];
+            for (int j=2; j<7; ++j) {
+                sum += k[j][i] * DP_E[j];
+            }
+            err[i] = sum * dt;
+        }
+
+        float e = error(x5, err);
+        bool accepted = e <= 1.f || dt <= minDt;
+        if (accepted) {
+            x0.swap(x5);
+            remaining -= dt;
+            ++lastSubsteps;
+            done = last;
+        } else {
+            ++lastRejected;
+        }
+
+        // usual step size controller, growth and shrink bounded
+        float factor = e > 0.f ? 0.9f * pow(e, -0.2f) : 5.f;
+        factor = min(5.f, max(0.2f, factor));
+        float next = max(minDt, dt * factor);
+        if (!last || !accepted) {
+            dtGuess = next;
+        }
+        dt = next;
+    }
+
+    particleSystem->setState(x0);
+    particleSystem->postStep(stepSize);
+}
+
+CFLStepper::CFLStepper(int maxSubsteps_) :
+    maxSubsteps(max(1, maxSubsteps_)),
+    lastSubstepped(0),
+    lastSubsteps(0) {
+}
+
+void CFLStepper::takeStep(ParticleSystem* particleSystem, float stepSize) {
+    particleSystem->getState(x0);
+    float limit = particleSystem->maxDisplacement();
+    lastSubstepped = 0;
+    lastSubsteps = 0;
+
+    for (int i=0; 2*i+1<(int)x0.size(); ++i) {
+        Vector3f pos = x0[2*i];
+        Vector3f vel = x0[2*i+1];
+        Vector3f a1 = particleSystem->evalAccel(i, pos, vel);
+
+        // displacement estimate from the state at the start of the step
+        int n = 1;
+        if (limit > 0.f) {
+            float travel = (vel * stepSize + a1 * (0.5f * stepSize * stepSize)).abs();
+            n = min(maxSubsteps, max(1, (int)ceil(travel / limit)));
+        }
+        if (n > 1) {
+            ++lastSubstepped;
+            lastSubsteps += n;
+        }
+
+        float h = stepSize / n;
+        for (int s=0; s<n; ++s) {
+            if (s > 0) {
+                a1 = particleSystem->evalAccel(i, pos, vel);
+            }
+            Vector3f v2 = vel + a1 * (h / 2);
+            Vector3f a2 = particleSystem->evalAccel(i, pos + vel * (h / 2), v2);
+            Vector3f v3 = vel + a2 * (h / 2);
+            Vector3f a3 = particleSystem->evalAccel(i, pos + v2 * (h / 2), v3);
+            Vector3f v4 = vel + a3 * h;
+            Vector3f a4 = particleSystem->evalAccel(i, pos + v3 * h, v4);
+
+            Vector3f next = pos + (vel + 2.f * v2 + 2.f * v3 + v4) * (h / 6);
+            vel = vel + (a1 + 2.f * a2 + 2.f * a3 + a4) * (h / 6);
+            if (n > 1) {
+                particleSystem->sweep(i, pos, next);
+            }
+            pos = next;
+        }
+        x0[2*i] = pos;
+        x0[2*i+1] = vel;
+    }
+
+    particleSystem->setState(x0);
+    particleSystem->postStep(stepSize);
+}
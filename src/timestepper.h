@@ -7,18 +7,97 @@
 
 #include "particlesystem.h"
 
+// Integrates a ParticleSystem's state vector over one step, then lets
+// the system apply its discrete changes (ParticleSystem::postStep).
+// Scratch vectors are kept between steps so steady-state steps do not
+// allocate.
 class TimeStepper
 {
 public:
     virtual ~TimeStepper() {}
 	virtual void takeStep(ParticleSystem* particleSystem, float stepSize) = 0;
+
+protected:
+    vector<Vector3f> x0;            // state at the start of the step
+    vector<Vector3f> xt;            // trial state
+    vector<Vector3f> k1;
+};
+
+// x1 = x0 + h f(x0)
+class ForwardEuler : public TimeStepper
+{
+	void takeStep(ParticleSystem* particleSystem, float stepSize) override;
+};
+
+// v1 = v0 + h a(x0), p1 = p0 + h v1
+class SemiImplicitEuler : public TimeStepper
+{
+	void takeStep(ParticleSystem* particleSystem, float stepSize) override;
 };
 
-//IMPLEMENT YOUR TIMESTEPPERS
+// x1 = x0 + h f(x0 + h/2 f(x0))
+class Midpoint : public TimeStepper
+{
+	void takeStep(ParticleSystem* particleSystem, float stepSize) override;
+};
 
+// classic fourth order Runge-Kutta
 class RK4 : public TimeStepper
 {
 	void takeStep(ParticleSystem* particleSystem, float stepSize) override;
+
+    vector<Vector3f> k2, k3, k4;
+};
+
+// Dormand-Prince 5(4): covers each step with as many substeps as the
+// embedded error estimate needs to stay within tolerance (relative to
+// the state, absolute for values near zero).
+class RK45 : public TimeStepper
+{
+public:
+    explicit RK45(float tolerance_ = 1e-4f, int maxSubsteps_ = 64);
+
+	void takeStep(ParticleSystem* particleSystem, float stepSize) override;
+
+    // Helper Observers
+    int substeps() const { return lastSubsteps; }   // used by the last step
+    int rejected() const { return lastRejected; }
+
+private:
+    // largest error component relative to the tolerance; accept when <= 1
+    float error(const vector<Vector3f>& x, const vector<Vector3f>& err) const;
+
+    float tolerance;
+    int maxSubsteps;                // floor for the substep size is h / maxSubsteps
+    float dtGuess;                  // substep size carried over between steps
+    int lastSubsteps;
+    int lastRejected;
+
+    vector<Vector3f> k[7];
+    vector<Vector3f> x5;
+    vector<Vector3f> err;
+};
+
+// RK4 per particle, sub-stepping only the particles that would move more
+// than the system's maxDisplacement() in one step. Every substep of a
+// sub-stepped particle is reported through ParticleSystem::sweep, so the
+// system can catch collisions the end positions alone would miss.
+// Relies on each particle's acceleration depending only on its own state.
+class CFLStepper : public TimeStepper
+{
+public:
+    explicit CFLStepper(int maxSubsteps_ = 32);
+
+	void takeStep(ParticleSystem* particleSystem, float stepSize) override;
+
+    // Helper Observers
+    int substepped() const { return lastSubstepped; }  // particles in the last step
+    int substeps() const { return lastSubsteps; }      // their substeps in total
+
+private:
+    int maxSubsteps;
+    int lastSubstepped;
+    int lastSubsteps;
 };
 
 /////////////////////////
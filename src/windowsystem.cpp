@@ -1,11 +1,14 @@
 #include "windowsystem.h"
 
 #include <cfloat>
+#include <ctime>
 #include <iostream>
-#include <iomanip>
+#include <stdexcept>
 
+#ifndef HEADLESS
 #include "camera.h"
 #include "vertexrecorder.h"
+#endif
 
 WindowSystem::WindowSystem(
         Vector3f origin_,
@@ -19,16 +22,25 @@ WindowSystem::WindowSystem(
     raininess(raininess_),
     dropletSize(dropletSize_) {
 
-    // initing random seed
-    srand(time(0));
+    // a fresh seed per run unless setSeed picks one
+    rngSeed = (uint64_t)time(0);
+    rng = Random(rngSeed, WORLD_STREAM);
 
     // set object attributes
+    pool.reset(new ThreadPool());
+    exporter.reset(new HeightMapExporter());
     gridSize = (int)floor(size / granularity);
+    lookAhead = 3;
+    windowSums = AUTO_SUMS;
+    useTables = false;
     resetIdMap();
     resetHeightMap();
     resetAffinityMap();
-    maxDropletIdx = -1;
     frameNo = 0;
+    substepLimit = 0.5f;
+    sleeping = true;
+    setExportPolicy(ExportPolicy());
+    buildQueryTables();
 
     // Debug Droplet generation
     //addDroplet(0.9f, Vector3f(1.6f, 1.5f, 0.f), Vector3f::ZERO);
@@ -37,34 +49,157 @@ WindowSystem::WindowSystem(
 
 }
 
+void WindowSystem::setThreadCount(int threads) {
+    pool.reset(new ThreadPool(threads));
+}
+
+void WindowSystem::setExportQueue(int encoders, int slots,
+        HeightMapExporter::Backpressure policy) {
+    // the old queue finishes writing its frames before it goes away
+    exporter.reset(new HeightMapExporter(encoders, slots, policy));
+}
+
+void WindowSystem::setExportPolicy(const ExportPolicy& policy) {
+    // queued frames may still be bound for the old sequence file
+    exporter->flush();
+    sequence.reset();
+    if (policy.sink == ExportPolicy::SEQUENCE) {
+        sequence.reset(new HeightSequenceWriter());
+        if (!sequence->open(policy.sequenceFilename(), gridSize, gridSize,
+                policy.sequenceEncoding, policy.keyEvery)) {
+            sequence.reset();
+            throw runtime_error("cannot write " + policy.sequenceFilename());
+        }
+    }
+    exportPolicy = policy;
+    keyFrameDue = true;
+    deltaFrames = 0;
+    simTime = 0.0;
+    nextExportTime = policy.fps > 0.f ? 1.0 / policy.fps : 0.0;
+    exportFrame = 0;
+}
+
+void WindowSystem::setSubstepLimit(float cellFraction) {
+    substepLimit = cellFraction;
+}
+
+void WindowSystem::setSleeping(bool enabled) {
+    sleeping = enabled;
+    if (!enabled) {
+        for (int i=0; i<droplets.size(); ++i) {
+            droplets.asleep[i] = 0;
+            droplets.stillSteps[i] = 0;
+        }
+        buildQueryTables();
+    }
+}
+
+void WindowSystem::setSeed(uint64_t seed) {
+    rngSeed = seed;
+    rng = Random(rngSeed, WORLD_STREAM);
+    resetAffinityMap();
+}
+
+void WindowSystem::setWindowSums(WindowSums sums) {
+    windowSums = sums;
+    buildQueryTables();
+}
+
+void WindowSystem::setLookAhead(int cells) {
+    lookAhead = max(1, cells);
+    affinity.prepare(lookAhead);
+}
+
+int WindowSystem::dropletCount() const {
+    return droplets.size();
+}
+
+int WindowSystem::sleepingCount() const {
+    int n = 0;
+    for (int i=0; i<droplets.size(); ++i) {
+        n += droplets.asleep[i];
+    }
+    return n;
+}
+
+void WindowSystem::copyHeightMap(Grid2D<float>& out) const {
+    // reuses out's block once it has the right size
+    out = heightMap;
+}
+
+void WindowSystem::copyIdMap(Grid2D<int>& out) const {
+    out = idMap;
+}
+
+void WindowSystem::flushExports() {
+    exporter->flush();
+    if (sequence) {
+        sequence->sync();
+    }
+}
+
 const float WindowSystem::G_NORM = 1.f;
 const Vector3f WindowSystem::G_DIR = Vector3f(0.f, -1.f, 0.f);
+const float WindowSystem::SLEEP_DRIFT = 0.05f;
+const int WindowSystem::SLEEP_STEPS = 30;
+const float WindowSystem::MASS_TOLERANCE = 1e-4f;
+
+float WindowSystem::dropletDraw(int h, int draw, float low, float hi) const {
+    // a pure function of (seed, droplet, step, draw), so it does not
+    // depend on the order droplets are visited in or on which thread asks
+    uint64_t key = Random::key(rngSeed, DROPLET_STREAMS + (uint64_t)h);
+    uint64_t index = (uint64_t)frameNo * DRAWS_PER_STEP + draw;
+    return Random::uniformAt(key, index, low, hi);
+}
 
 void WindowSystem::resetIdMap() {
-    idMap = vector<vector<int>>(gridSize, vector<int>(gridSize, -1));
+    if (idMap.width() != gridSize) {
+        idMap.resize(gridSize, gridSize, -1);
+        idTiles.resize(gridSize);
+        return;
+    }
+    // only tiles written since the last reset can hold ids
+    for (int ty=0; ty<idTiles.rows(); ++ty) {
+        for (int tx=0; tx<idTiles.rows(); ++tx) {
+            if (!idTiles.test(ty, tx)) continue;
+            for (int y=idTiles.cellBegin(ty); y<idTiles.cellEnd(ty); ++y) {
+                fill(idMap[y] + idTiles.cellBegin(tx),
+                        idMap[y] + idTiles.cellEnd(tx), -1);
+            }
+        }
+    }
+    idTiles.clear();
 }
 
 void WindowSystem::resetHeightMap() {
-    heightMap = vector<vector<float>>(gridSize, vector<float>(gridSize, 0.f));
+    if (heightMap.width() != gridSize) {
+        heightMap.resize(gridSize, gridSize, 0.f);
+    } else {
+        heightMap.clear();
+    }
+    wetTiles.resize(gridSize);
+    changedTiles.resize(gridSize);
+    keyFrameDue = true;
 }
 
 void WindowSystem::resetAffinityMap() {
-    affinityMap = vector<vector<float>>(gridSize, vector<float>(gridSize, 0.f));
-    for (int y=0; y<gridSize; ++y) {
-        for (int x=0; x<gridSize; ++x) {
-            affinityMap[y][x] = rand_uniform(0.f, 1.f);
-        }
+    Random field(rngSeed, AFFINITY_STREAM);
+    affinity.random(gridSize, field);
+    affinity.prepare(lookAhead);
+}
+
+void WindowSystem::setAffinity(const AffinityField& field) {
+    if (field.size() != gridSize) {
+        throw invalid_argument("affinity field does not match the grid");
     }
+    affinity = field;
+    affinity.prepare(lookAhead);
 }
 
-void WindowSystem::addDroplet(float mass, Vector3f pos, Vector3f vel) {
-    ++maxDropletIdx;
-    int droplet_idx = maxDropletIdx;
-    droplets.insert(pair <int, Droplet *> (droplet_idx, new Droplet(droplet_idx, mass, granularity)));
+int WindowSystem::addDroplet(float mass, Vector3f pos, Vector3f vel) {
     // for debugging
     Vector3f aligned_pos = getGridPos(getGridIdx(pos));
-    posState.insert(pair <int, Vector3f> (droplet_idx, aligned_pos));
-    velState.insert(pair <int, Vector3f> (droplet_idx, vel));
+    return droplets.add(mass, aligned_pos, vel, Droplet(mass, rng));
 }
 
 vector<int> WindowSystem::getGridIdx(Vector3f pos) {
@@ -85,337 +220,576 @@ vector<int> WindowSystem::clipIdx(vector<int> idx) {
     });
 }
 
-map<int, Vector3f> WindowSystem::evalAccel() {
-    map<int, Vector3f> accel;
-    for (const auto& it : droplets) {
-        int i = it.first;
+Vector3f WindowSystem::evalAccel(int i, const Vector3f& pos, const Vector3f& vel) {
+    if (droplets.asleep[i]) {
+        return Vector3f::ZERO;
+    }
+
+    int h = droplets.handle[i];
+    float m = droplets.mass[i];
+
+    // calculate external forces
+    Vector3f extAccel = Vector3f::ZERO;
+    extAccel += G_DIR * G_NORM * m;
+    if (vel != Vector3f::ZERO)
+        extAccel += -vel.normalized() * G_NORM * Droplet::STATIC_MASS;
+    else
+        extAccel += G_DIR * G_NORM * m;
+    extAccel /= m;
+
+    // calculate droplet "tug" forces
+    int gy = (int)floor(pos.y()/granularity);
+    int gx = (int)floor(pos.x()/granularity);
+    const SummedAreaTable& own = useTables ? ownSums[i] : heightSums;
+
+    // check which direction has more water: lookAhead-wide windows below
+    // the droplet, down-left, straight down and down-right
+    float masses[3];
+    float maxMass = 0.f;
+    for (int x=0; x < 3; ++x) {
+        int y0, y1, x0, x1;
+        AffinityField::window(gy, gx, x, lookAhead, gridSize, y0, y1, x0, x1);
+
+        // water outside the droplet's own cells; heights are either zero
+        // or well above the rounding of the table differences
+        double water = 0.0;
+        if (useTables) {
+            water = heightSums.sum(y0, x0, y1, x1) - own.sum(y0, x0, y1, x1);
+        } else {
+            float mass = 0.f;
+            for (int fy=y0; fy < y1; ++fy) {
+                for (int fx=x0; fx < x1; ++fx) {
+                    if (idMap[fy][fx] != h)
+                        mass += heightMap[fy][fx];
+                }
+            }
+            water = mass;
+        }
+        masses[x] = water > 1e-6 ? (float)water : 0.f;
+        maxMass = max(maxMass, masses[x]);
+    }
+    // the first window within rounding of the most water wins: the float
+    // loop and the double tables round differently, and windows holding
+    // the same water must tie the same way on both
+    int bestX = 0;
+    while (masses[bestX] < maxMass * (1.f - MASS_TOLERANCE)) ++bestX;
+    // no water: follow the glass, or a random way where it has no pull
+    if (maxMass == 0.f) {
+        bestX = affinity.bestDirection(gy, gx);
+        if (bestX < 0) {
+            bestX = min(2, (int)floor(dropletDraw(h, TUG_DRAW, 0.f, 3.f)));
+        }
+    }
+
+    Vector3f accelDir = Vector3f::RIGHT * (bestX - 1);
+    float accelNorm = 1.f;
+    return accelDir * accelNorm + extAccel;
+}
+
+void WindowSystem::getState(vector<Vector3f>& state) const {
+    state.resize(2 * droplets.size());
+    for (int i=0; i<droplets.size(); ++i) {
+        state[2*i] = droplets.pos[i];
+        state[2*i+1] = droplets.vel[i];
+    }
+}
 
-        // calculate external forces
-        Vector3f extAccel = Vector3f::ZERO;
-        extAccel += G_DIR * G_NORM * droplets[i]->mass;
-        if (velState[i] != Vector3f::ZERO)
-            extAccel += -velState[i].normalized() * G_NORM * droplets[i]->STATIC_MASS;
-        else
-            extAccel += G_DIR * G_NORM * droplets[i]->mass;
-        extAccel /= droplets[i]->mass;
+void WindowSystem::setState(const vector<Vector3f>& state) {
+    for (int i=0; i<droplets.size(); ++i) {
+        droplets.pos[i] = state[2*i];
+        droplets.vel[i] = state[2*i+1];
+    }
+}
 
-        // calculate droplet "tug" forces
-        vector<int> gridIdx = getGridIdx(posState[i]);
+void WindowSystem::evalF(const vector<Vector3f>& state, vector<Vector3f>& f) {
+    PROFILE_SCOPE(stepProfile, Profiler::ACCEL);
+    // the maps stay as rasterized at the end of the last step
+    f.resize(state.size());
+    for (int i=0; i<droplets.size(); ++i) {
+        if (droplets.asleep[i]) {
+            f[2*i] = f[2*i+1] = Vector3f::ZERO;
+            continue;
+        }
+        f[2*i] = state[2*i+1];
+        f[2*i+1] = evalAccel(i, state[2*i], state[2*i+1]);
+    }
+}
 
-        float maxMass = 0.f;
-        float maxAffinity = 0.f;
-        int bestX = 1;//(int)floor(rand_uniform(0.f, 3.f));
-        int bestAX = (int)floor(rand_uniform(0.f, 3.f));
+void WindowSystem::buildQueryTables() {
+    // the tables cost a pass over the wet area, the direct sums a pass
+    // over every window of every awake droplet in each of the ~4 force
+    // evaluations of a step; build them only when they are cheaper
+    int n = droplets.size();
+    int awake = n - sleepingCount();
+    useTables = windowSums == TABLE_SUMS || (windowSums == AUTO_SUMS &&
+            12.0 * awake * lookAhead * lookAhead > (double)gridSize * gridSize);
+    if (!useTables) return;
+
+    // rows and columns outside the wet tiles are dry and sum to zero
+    int ty0 = wetTiles.rows(), ty1 = 0, tx0 = wetTiles.rows(), tx1 = 0;
+    for (int ty=0; ty<wetTiles.rows(); ++ty) {
+        int rx0, rx1;
+        if (!wetTiles.rowSpan(ty, rx0, rx1)) continue;
+        ty0 = min(ty0, ty);
+        ty1 = ty + 1;
+        tx0 = min(tx0, rx0);
+        tx1 = max(tx1, rx1);
+    }
+    if (ty0 < ty1) {
+        int y0 = wetTiles.cellBegin(ty0), x0 = wetTiles.cellBegin(tx0);
+        heightSums.build(heightMap.view(), y0, x0,
+                wetTiles.cellEnd(ty1-1) - y0, wetTiles.cellEnd(tx1-1) - x0);
+    } else {
+        heightSums.clear();
+    }
 
-        // check which direction has more water
-        for (int x=0; x < 3; ++x) {
+    // own cells can only be under the droplet's hemispheres, or under the
+    // single hemisphere a merged droplet is stamped with
+    if ((int)ownSums.size() < n) {
+        ownSums.resize(n);
+    }
+    for (int i=0; i<n; ++i) {
+        if (droplets.asleep[i]) {
+            ownSums[i].clear();
+            continue;
+        }
+        int y0, y1, x0, x1;
+        rasterizer.cellBounds(droplets, i, granularity, gridSize, y0, y1, x0, x1);
+        float r = Droplet::radius(droplets.mass[i]);
+        vector<int> lo = clipIdx(getGridIdx(droplets.pos[i] + Vector3f(-r, -r, 0.f)));
+        vector<int> hi = clipIdx(getGridIdx(droplets.pos[i] + Vector3f(r, r, 0.f)));
+        y0 = min(y0, lo[0]);
+        x0 = min(x0, lo[1]);
+        y1 = max(y1, hi[0]);
+        x1 = max(x1, hi[1]);
+        ownSums[i].build(heightMap.view(), idMap.view(), droplets.handle[i],
+                y0, x0, y1 - y0 + 1, x1 - x0 + 1);
+    }
+}
 
-            vector<int> gi({gridIdx[0]-2, gridIdx[1]-3+x*2});
-            vector<int> gr({gi[0]+3, gi[1]+3});
-            vector<int> clipped_gi = clipIdx(gi);
-            vector<int> clipped_gr = clipIdx(gr);
+void WindowSystem::updateSleep(float stepSize) {
+    if (!sleeping) return;
+    PROFILE_SCOPE(stepProfile, Profiler::SLEEP);
 
-            float mass = 0.f;
-            float affinity = 0.f;
-            for (int fy=clipped_gi[0]; fy < clipped_gr[0]; ++fy) {
-                for (int fx=clipped_gi[1]; fx < clipped_gr[1]; ++fx) {
-                    if (idMap[fy][fx] != i)
-                        mass += heightMap[fy][fx];
-                    affinity += affinityMap[fy][fx];
-                }
-            }
-            if (mass > maxMass) {
-                maxMass = mass;
-                bestX = x;
+    // droplets about to merge are the events; their tiles wake neighbours
+    if (eventTiles.rows() == 0) {
+        eventTiles.resize(gridSize);
+    } else {
+        eventTiles.clear();
+    }
+    if (!mergeSets.empty()) {
+        for (int i=0; i<droplets.size(); ++i) {
+            if (mergeSets.grouped(i)) {
+                rasterizer.markFootprint(i, eventTiles);
             }
-            if (affinity > maxAffinity) {
-                maxAffinity = affinity;
-                bestAX = x;
+        }
+    }
+
+    // water arriving or drying up under a tug window changes the pull
+    if (sleepWetTiles.rows() != wetTiles.rows()) {
+        sleepWetTiles.resize(gridSize);
+        wetChanges.resize(gridSize);
+    }
+    wetChanges.differ(sleepWetTiles, wetTiles);
+    bool wetChanged = wetChanges.any();
+    sleepWetTiles = wetTiles;
+
+    float stillSpeed = SLEEP_DRIFT * granularity / stepSize;
+    for (int i=0; i<droplets.size(); ++i) {
+        if (mergeSets.grouped(i)) continue;     // replaced by the merge
+        bool event = (!mergeSets.empty() && rasterizer.touches(i, eventTiles)) ||
+                (wetChanged && windowsTouch(i, wetChanges));
+
+        if (droplets.asleep[i]) {
+            if (event) {
+                droplets.asleep[i] = 0;
+                droplets.stillSteps[i] = 0;
             }
+            continue;
         }
-        if (maxMass == 0.f) {
-            bestX = bestAX;
+        if (event || droplets.mass[i] >= Droplet::STATIC_MASS ||
+                droplets.vel[i].absSquared() > stillSpeed*stillSpeed) {
+            droplets.stillSteps[i] = 0;
+        } else if (++droplets.stillSteps[i] >= SLEEP_STEPS) {
+            droplets.asleep[i] = 1;
+            droplets.vel[i] = Vector3f::ZERO;
         }
+    }
+}
 
-        Vector3f accelDir = Vector3f::RIGHT * (bestX - 1);
-        float accelNorm = 1.f;
-        accel[i] = accelDir * accelNorm + extAccel;
+bool WindowSystem::windowsTouch(int i, const TileMask& tiles) const {
+    // the windows side by side span those of the outer two directions
+    int gy = (int)floor(droplets.pos[i].y()/granularity);
+    int gx = (int)floor(droplets.pos[i].x()/granularity);
+    int y0, y1, x0, x1, ry0, ry1, rx0, rx1;
+    AffinityField::window(gy, gx, 0, lookAhead, gridSize, y0, y1, x0, x1);
+    AffinityField::window(gy, gx, 2, lookAhead, gridSize, ry0, ry1, rx0, rx1);
+    x1 = rx1;
+    if (y0 >= y1 || x0 >= x1) return false;
+
+    for (int ty=y0 >> TileMask::TILE_SHIFT; ty<=(y1-1) >> TileMask::TILE_SHIFT; ++ty) {
+        for (int tx=x0 >> TileMask::TILE_SHIFT; tx<=(x1-1) >> TileMask::TILE_SHIFT; ++tx) {
+            if (tiles.test(ty, tx)) return true;
+        }
     }
-    return accel;
+    return false;
+}
+
+float WindowSystem::maxDisplacement() const {
+    return substepLimit * granularity;
 }
 
-void WindowSystem::takeStep(float stepSize) {
+void WindowSystem::sweep(int i, const Vector3f& from, const Vector3f& to) {
+    // swept circle against the footprints rasterized last step: any other
+    // droplet the circle touches on its way from -> to merges this step
+    int h = droplets.handle[i];
+    float r = Droplet::radius(droplets.mass[i]);
+    Vector3f lo(min(from.x(), to.x()) - r, min(from.y(), to.y()) - r, 0.f);
+    Vector3f hi(max(from.x(), to.x()) + r, max(from.y(), to.y()) + r, 0.f);
+    vector<int> loIdx = clipIdx(getGridIdx(lo));
+    vector<int> hiIdx = clipIdx(getGridIdx(hi));
+
+    Vector3f seg = to - from;
+    float segSq = seg.absSquared();
+    for (int y=loIdx[0]; y<=hiIdx[0]; ++y) {
+        for (int x=loIdx[1]; x<=hiIdx[1]; ++x) {
+            int other = idMap[y][x];
+            if (other == -1 || other == h) continue;
+
+            // distance from the cell centre to the segment
+            Vector3f p = getGridPos(vector<int>({y, x})) - from;
+            float t = segSq > 0.f ? min(1.f, max(0.f, Vector3f::dot(p, seg) / segSq)) : 0.f;
+            if ((p - seg * t).absSquared() <= r*r &&
+                    (sweptMerges.empty() || sweptMerges.back() != make_pair(h, other))) {
+                sweptMerges.push_back(make_pair(h, other));
+            }
+        }
+    }
+}
+
+void WindowSystem::postStep(float stepSize) {
 
     ++frameNo;
 
-    // Apply movement to existing droplets
-    map<int, Vector3f> accelState = evalAccel();
+    spawnDroplets();
+    splitDroplets(stepSize);
+    cullDroplets();
+
+    // Construct Height Map and idMap, and find the droplets to merge
+    rasterizeDroplets();
+    scanMerges();
+    updateSleep(stepSize);
+    resolveMerges();
+
+    // Blur Height Map
+    blurHeightMap();
+    erodeHeightMap();
+    changedTiles.add(wetTiles);
+
+    // Tables for the next step's evalAccel
+    {
+        PROFILE_SCOPE(stepProfile, Profiler::TABLES);
+        buildQueryTables();
+    }
+
+    // Store Height Map
+    simTime += stepSize;
+    if (exportDue()) {
+        PROFILE_SCOPE(stepProfile, Profiler::EXPORT);
+        ++exportFrame;
+        if (exportPolicy.sink == ExportPolicy::SEQUENCE) {
+            appendSequenceFrame();
+        } else if (exportPolicy.sink != ExportPolicy::NONE) {
+            string fname = exportPolicy.filename(exportFrame);
+            if (exportPolicy.verbose) cout << fname << endl;
+            HeightMapExporter::Format format = exportPolicy.sink == ExportPolicy::RAW ?
+                HeightMapExporter::RAW : HeightMapExporter::PNG;
+            exporter->submit(heightMap.view(), fname, 20.f, true, format, exportPolicy.png);
+        }
+    }
 
-    for (const auto& it : droplets) {
-        int i = it.first;
-        posState[i] += velState[i] * stepSize;
-        velState[i] += accelState[i] * stepSize;
+    stepProfile.count(Profiler::DROPLETS, droplets.size());
+    if (stepProfile.enabled()) {
+        stepProfile.count(Profiler::ACTIVE_CELLS, wetTiles.cellCount());
     }
-    
-    // Generate new droplets
-    if (rand_uniform(0.f, 1.f) < raininess) {
-        float mass = rand_uniform(dropletSize[0], dropletSize[1]);
-        Vector3f pos = Vector3f(rand_uniform(0.f, size), rand_uniform(0.f, size), 0.f);
+}
+
+void WindowSystem::spawnDroplets() {
+    PROFILE_SCOPE(stepProfile, Profiler::SPAWN);
+    if (rng.uniform(0.f, 1.f) < raininess) {
+        float mass = rng.uniform(dropletSize[0], dropletSize[1]);
+        float x = rng.uniform(0.f, size);
+        Vector3f pos = Vector3f(x, rng.uniform(0.f, size), 0.f);
         Vector3f vel = Vector3f::ZERO;
         addDroplet(mass, pos, vel);
     }
+}
 
-    // Generate residual droplets
-    for (const auto& it : droplets) {
-        int i = it.first;
-        if (droplets[i]->mass >= droplets[i]->STATIC_MASS) {
-            droplets[i]->split_time += stepSize;
-            if (rand_uniform(0.f, 1.f) < droplets[i]->splitProb(stepSize)) {
+void WindowSystem::splitDroplets(float stepSize) {
+    // residual droplets left behind by heavy ones
+    PROFILE_SCOPE(stepProfile, Profiler::SPLIT);
+    for (int i=0, n=droplets.size(); i<n; ++i) {
+        if (droplets.mass[i] >= Droplet::STATIC_MASS) {
+            droplets.splitTime[i] += stepSize;
+            int h = droplets.handle[i];
+            if (dropletDraw(h, SPLIT_DRAW, 0.f, 1.f) < Droplet::splitProb(droplets.splitTime[i], stepSize)) {
                 // add new droplet
-                float mass = min(droplets[i]->STATIC_MASS, rand_uniform(0.1f, 0.3f)*droplets[i]->mass);
+                float mass = min(Droplet::STATIC_MASS, dropletDraw(h, SPLIT_MASS_DRAW, 0.1f, 0.3f)*droplets.mass[i]);
                 // TODO: magic number
-                Vector3f pos = posState[i] - velState[i] * stepSize * 20;
+                Vector3f pos = droplets.pos[i] - droplets.vel[i] * stepSize * 20;
                 Vector3f vel = Vector3f::ZERO;
                 addDroplet(mass, pos, vel);
 
                 // update OG droplet
-                droplets[i]->mass -= mass;
-                droplets[i]->split_time = 0.f;
+                droplets.mass[i] -= mass;
+                droplets.splitTime[i] = 0.f;
             }
         }
     }
+}
 
-    // Delete clipped droplets
-    for (const auto& it : droplets) {
-        int i = it.first;
-        if (posState[i].y() < 0.f || posState[i].y() > size ||
-                posState[i].x() < 0.f || posState[i].x() > size) {
-
-            delete droplets[i];
-            droplets.erase(i);
-            posState.erase(i);
-            velState.erase(i);
+void WindowSystem::cullDroplets() {
+    // clipped droplets are not rasterized, and are compacted away with
+    // the merged ones at the end of the step
+    PROFILE_SCOPE(stepProfile, Profiler::CULL);
+    for (int i=0; i<droplets.size(); ++i) {
+        const Vector3f& pos = droplets.pos[i];
+        if (pos.y() < 0.f || pos.y() > size ||
+                pos.x() < 0.f || pos.x() > size) {
+            droplets.kill(droplets.handle[i]);
         }
     }
+}
 
-    // Construct Height Map and idMap
-    vector<set<int>> toMerge;
-    map<int, int> setLookupTable;
-
+void WindowSystem::rasterizeDroplets() {
+    PROFILE_SCOPE(stepProfile, Profiler::RASTERIZE);
     resetIdMap();
+    mergeSets.reset(droplets.size());
 
-    for (const auto& it : droplets) {
-        int i = it.first;
-        Droplet * d = droplets[i];
-        vector<Vector3f> offsetChain = d->getOffsetChain();
+    rasterizer.rasterize(droplets, granularity, heightMap, idMap,
+            idTiles, wetTiles, *pool, overlaps);
+    for (const auto& overlap : overlaps) {
+        mergeSets.unite(overlap.first, overlap.second);
+    }
+    // hits from sub-stepped droplets, unless one side has been culled
+    for (const auto& hit : sweptMerges) {
+        if (droplets.contains(hit.first) && droplets.contains(hit.second)) {
+            mergeSets.unite(droplets.slot(hit.first), droplets.slot(hit.second));
+        }
+    }
+    sweptMerges.clear();
+}
 
-        Vector3f center = posState[i];
-        for (int sd_i=0; sd_i<(int)offsetChain.size(); ++sd_i) {
-            float r = d->radius(d->mass * d->getDist()[sd_i]);
-            float rSq = r*r;
-            center += offsetChain[sd_i];
-            vector<int> lo = clipIdx(getGridIdx(center + Vector3f(-r, -r, 0.f)));
-            vector<int> hi = clipIdx(getGridIdx(center + Vector3f(r, r, 0.f)));
-            for (int y=lo[0]; y <= hi[0]; ++y) {
-                for (int x=lo[1]; x <= hi[1]; ++x) {
-                    float heightSq = rSq - (getGridPos(vector<int>({y, x})) - center).absSquared();
-                    if (heightSq > 0 && heightSq > pow(heightMap[y][x],2)) {
-                        heightMap[y][x] = sqrt(heightSq);
-                        if (idMap[y][x] != -1) {
-                            int j = idMap[y][x];
-                            bool iSetExists = setLookupTable.find(i) != setLookupTable.end();
-                            bool jSetExists = setLookupTable.find(j) != setLookupTable.end();
-                            int setIdx;
-                            if (iSetExists) {
-                                setIdx = setLookupTable[i];
-                            } else if (jSetExists) {
-                                setIdx = setLookupTable[j];
-                            } else {
-                                toMerge.push_back(set<int>());
-                                setIdx = toMerge.size() - 1;
-                            }
-                            toMerge[setIdx].insert(idMap[y][x]);
-                            toMerge[setIdx].insert(i);
-                            setLookupTable[idMap[y][x]] = setIdx;
-                            setLookupTable[i] = setIdx;
+void WindowSystem::scanMerges() {
+    // droplets in neighbouring idMap cells merge
+    PROFILE_SCOPE(stepProfile, Profiler::MERGE_SCAN);
+    for (int ty=0; ty<idTiles.rows(); ++ty) {
+        for (int tx=0; tx<idTiles.rows(); ++tx) {
+            if (!idTiles.test(ty, tx)) continue;
+            int yEnd = min(idTiles.cellEnd(ty), gridSize-1);
+            int xEnd = min(idTiles.cellEnd(tx), gridSize-1);
+            for (int y=max(idTiles.cellBegin(ty), 1); y<yEnd; ++y) {
+                for (int x=max(idTiles.cellBegin(tx), 1); x<xEnd; ++x) {
+                    if (idMap[y][x] == -1) continue;
+
+                    for (int fy=-1; fy<2; ++fy) {
+                        for (int fx=-1; fx<2; ++fx) {
+                            if (fy == 0 && fx == 0) continue;
+                            if (idMap[y+fy][x+fx] == -1) continue;
+                            if (idMap[y+fy][x+fx] == idMap[y][x]) continue;
+                            // neighbor merge between the two should happen
+                            mergeSets.unite(droplets.slot(idMap[y][x]),
+                                    droplets.slot(idMap[y+fy][x+fx]));
                         }
-                        idMap[y][x] = i;
                     }
                 }
             }
         }
     }
+}
 
-    // find adjacent idmaps to merge
-    for (int y=1; y<gridSize-1; ++y) {
-        for (int x=1; x<gridSize-1; ++x) {
-            if (idMap[y][x] == -1) continue;
-
-            for (int fy=-1; fy<2; ++fy) {
-                for (int fx=-1; fx<2; ++fx) {
-                    if (fy == 0 && fx == 0) continue;
-                    if (idMap[y+fy][x+fx] == -1) continue;
-                    if (idMap[y+fy][x+fx] == idMap[y][x]) continue;
-                    // neighbor merge between the two should happen
-                    int i = idMap[y][x],
-                        j = idMap[y+fy][x+fx];
-                    bool iSetExists = setLookupTable.find(i) != setLookupTable.end();
-                    bool jSetExists = setLookupTable.find(j) != setLookupTable.end();
-                    int setIdx;
-                    if (iSetExists) {
-                        setIdx = setLookupTable[i];
-                    } else if (jSetExists) {
-                        setIdx = setLookupTable[j];
-                    } else {
-                        toMerge.push_back(set<int>());
-                        setIdx = toMerge.size() - 1;
+void WindowSystem::resolveMerges() {
+    PROFILE_SCOPE(stepProfile, Profiler::MERGE_RESOLVE);
+    if (!mergeSets.empty()) {
+        // Clean up IDMap
+        for (int ty=0; ty<idTiles.rows(); ++ty) {
+            for (int tx=0; tx<idTiles.rows(); ++tx) {
+                if (!idTiles.test(ty, tx)) continue;
+                for (int y=idTiles.cellBegin(ty); y<idTiles.cellEnd(ty); ++y) {
+                    for (int x=idTiles.cellBegin(tx); x<idTiles.cellEnd(tx); ++x) {
+                        if (idMap[y][x] != -1 && mergeSets.grouped(droplets.slot(idMap[y][x]))) {
+                            idMap[y][x] = -1;
+                        }
                     }
-                    toMerge[setIdx].insert(i);
-                    toMerge[setIdx].insert(j);
-                    setLookupTable[i] = setIdx;
-                    setLookupTable[j] = setIdx;
                 }
             }
         }
-    }
 
-    // Clean up IDMap
-    set<int> dirtyIds;
-    for (const auto& blob : toMerge) {
-        dirtyIds.insert(blob.begin(), blob.end());
-    }
+        // removal is deferred, so member slots stay valid while merging
+        mergeSets.collect(mergeMembers, mergeOffsets);
+        stepProfile.count(Profiler::MERGES, (int)mergeOffsets.size() - 1);
 
-    for (int y=0; y<gridSize; ++y) {
-        for (int x=0; x<gridSize; ++x) {
-            if (dirtyIds.find(idMap[y][x]) != dirtyIds.end()) {
-                idMap[y][x] = -1;
+        for (int blob=0; blob+1<(int)mergeOffsets.size(); ++blob) {
+            // Calculate state for new droplet
+            float mass = 0.f;
+            Vector3f pos(0.f, FLT_MAX, 0.f);
+            Vector3f vel = Vector3f::ZERO;
+            for (int k=mergeOffsets[blob]; k<mergeOffsets[blob+1]; ++k) {
+                int di = mergeMembers[k];
+                mass += droplets.mass[di];
+                pos = droplets.pos[di].y() < pos.y() ? droplets.pos[di] : pos;
+                vel += droplets.mass[di] * droplets.vel[di];
+
+                droplets.kill(droplets.handle[di]);
             }
-        }
-    }
-    //cout << "DEBUG" << endl;
-    //for (const auto& blob : toMerge) {
-    //    for (const auto& idx : blob) {
-    //        cout << idx << "  ";
-    //    }
-    //    cout << endl;
-    //}
-    //for (const auto& foo : setLookupTable) {
-    //    cout << foo.first << "->" << foo.second << endl;
-    //}
-    //cout << "DEBUG END" << endl;
-
-    for (const auto& blob : toMerge) {
-        // Calculate state for new droplet
-        float mass = 0.f;
-        Vector3f pos(0.f, FLT_MAX, 0.f);
-        Vector3f vel = Vector3f::ZERO;
-        for (const auto& idx : blob) {
-            mass += droplets[idx]->mass;
-            pos = posState[idx].y() < pos.y() ? posState[idx] : pos;
-            vel += droplets[idx]->mass * velState[idx];
-
-            delete droplets[idx];
-            droplets.erase(idx);
-            posState.erase(idx);
-            velState.erase(idx);
-        }
-        vel *= 1.6f / mass;
-        // Init new drops
-        addDroplet(mass, pos, vel);
-        // Update idMap for the new droplet
-        int i = maxDropletIdx;
-        float r = droplets[i]->radius(droplets[i]->mass);
-        float rSq = r*r;
-        vector<int> lo = clipIdx(getGridIdx(posState[i] + Vector3f(-r, -r, 0.f)));
-        vector<int> hi = clipIdx(getGridIdx(posState[i] + Vector3f(r, r, 0.f)));
-        for (int y=lo[0]; y < hi[0]; ++y) {
-            for (int x=lo[1]; x < hi[1]; ++x) {
-                float heightSq = rSq - (getGridPos(vector<int>({y, x})) - posState[i]).absSquared();
-                if (heightSq > 0 && heightSq > pow(heightMap[y][x],2)) {
-                    idMap[y][x] = i;
+            vel *= 1.6f / mass;
+            // Init new drops
+            int i = addDroplet(mass, pos, vel);
+            // Update idMap for the new droplet
+            int di = droplets.slot(i);
+            float r = Droplet::radius(droplets.mass[di]);
+            float rSq = r*r;
+            vector<int> lo = clipIdx(getGridIdx(droplets.pos[di] + Vector3f(-r, -r, 0.f)));
+            vector<int> hi = clipIdx(getGridIdx(droplets.pos[di] + Vector3f(r, r, 0.f)));
+            for (int y=lo[0]; y < hi[0]; ++y) {
+                for (int x=lo[1]; x < hi[1]; ++x) {
+                    float heightSq = rSq - (getGridPos(vector<int>({y, x})) - droplets.pos[di]).absSquared();
+                    if (heightSq > 0 && heightSq > heightMap[y][x]*heightMap[y][x]) {
+                        idMap[y][x] = i;
+                        idTiles.mark(y, x);
+                    }
                 }
             }
         }
     }
 
-    // Blur Height Map
-    blurHeightMap();
-    erodeHeightMap();
+    // Drop the killed droplets and free their handles
+    droplets.compact();
+}
 
-    // Store Height Map
-    Image im(gridSize, gridSize, 1);
-    for (int y=0; y<gridSize; ++y) {
-        for (int x=0; x<gridSize; ++x) {
-            im(x,gridSize-1-y) = heightMap[y][x] * 20;
+void WindowSystem::appendSequenceFrame() {
+    if (sequence->encoding() != HeightSequence::TILE_DELTA) {
+        exporter->append(heightMap.view(), *sequence, simTime);
+        return;
+    }
+    // a cell can only change if it was wet before or after, and the
+    // rasterizer and erosion mark every tile they wet in wetTiles (blur
+    // only clears its flags), so the tiles wet at the last frame or after
+    // any step since hold every change; a delta frame reads just them.
+    // Keyframes (and the frame after a dropped one, which the decoder
+    // would miss) are written whole
+    if (keyFrameDue || deltaFrames + 1 >= max(1, exportPolicy.keyEvery)) {
+        if (exporter->append(heightMap.view(), *sequence, simTime)) {
+            exportedHeights = heightMap;
+            keyFrameDue = false;
+            deltaFrames = 0;
+        }
+    } else {
+        HeightSequence::packDelta(heightMap.view(), exportedHeights.view(), changedTiles,
+                deltaFrame);
+        if (exporter->appendDelta(deltaFrame, *sequence, simTime)) {
+            ++deltaFrames;
+        } else {
+            keyFrameDue = true;
         }
     }
-    ostringstream fname;
-    fname << "../Output/heightmap";
-    fname << setfill('0') << setw(4);
-    fname << frameNo;
-    fname << ".png";
-    cout << fname.str() << endl;
-    im.write(fname.str());
+    changedTiles = wetTiles;
+}
 
+bool WindowSystem::exportDue() {
+    if (exportPolicy.fps <= 0.f) {
+        return frameNo % max(1, exportPolicy.everySteps) == 0;
+    }
+    // one frame per crossed 1/fps boundary, however many a step spans
+    double period = 1.0 / exportPolicy.fps;
+    if (simTime + 1e-6 < nextExportTime) return false;
+    while (nextExportTime <= simTime + 1e-6) {
+        nextExportTime += period;
+    }
+    return true;
 }
 
-void WindowSystem::blurHeightMap(float epsilon) {
-    vector<vector<float>> newMap(heightMap.begin(), heightMap.end());
-    for (int y=0; y<gridSize; ++y) {
-        for (int x=0; x<gridSize; ++x) {
-            float newHeight = 0.f;
-            for (int fx=-1; fx<2; ++fx) {
-                int xx = max(0, min(gridSize-1, x+fx));
-                newHeight += heightMap[y][xx];
-            }
-            newMap[y][x] = newHeight / 3.f;
+void WindowSystem::blurHeightMap(float epsilon, int radius) {
+    PROFILE_SCOPE(stepProfile, Profiler::BLUR);
+    // the blur spreads at most radius cells, so only wet tiles and their
+    // neighbours can change; blur them in bands of consecutive tile rows
+    int reach = (radius + TileMask::TILE_SIZE - 1) >> TileMask::TILE_SHIFT;
+    wetTiles.dilate(blurTiles, reach);
+    for (int ty0=0; ty0<blurTiles.rows(); ) {
+        int tx0, tx1;
+        if (!blurTiles.rowSpan(ty0, tx0, tx1)) {
+            ++ty0;
+            continue;
         }
-    }
-    for (int y=0; y<gridSize; ++y) {
-        for (int x=0; x<gridSize; ++x) {
-            float newHeight = 0.f;
-            for (int fy=-1; fy<2; ++fy) {
-                int yy = max(0, min(gridSize-1, y+fy));
-                newHeight += newMap[yy][x];
+        // bands closer than the radius would read each other's output,
+        // so bridge gaps of fewer than reach tile rows
+        int ty1 = ty0 + 1;
+        int end = ty1;
+        int rx0, rx1;
+        while (ty1 < blurTiles.rows() && ty1 - end < reach) {
+            if (blurTiles.rowSpan(ty1, rx0, rx1)) {
+                tx0 = min(tx0, rx0);
+                tx1 = max(tx1, rx1);
+                end = ty1 + 1;
             }
-            heightMap[y][x] = newHeight / 3.f;
-        }
-    }
-    for (int y=0; y<gridSize; ++y) {
-        for (int x=0; x<gridSize; ++x) {
-            heightMap[y][x] = heightMap[y][x] >= epsilon ? heightMap[y][x] : 0.f;
+            ++ty1;
         }
+        blur.blurBand(heightMap.view(),
+                blurTiles.cellBegin(ty0), blurTiles.cellEnd(end-1),
+                blurTiles.cellBegin(tx0), blurTiles.cellEnd(tx1-1),
+                radius, epsilon, wetTiles);
+        ty0 = end;
     }
 }
 
 void WindowSystem::erodeHeightMap(float factor) {
-    for (int y=0; y<gridSize; ++y) {
-        vector<float> row(heightMap[y].begin(), heightMap[y].end());
-        for (int x=0; x<gridSize; ++x) {
-            if (idMap[y][x] != -1) continue;
-            if (row[x] == 0.f) continue;
-            bool erodeRight = (x == 0 || row[x-1] == 0.f);
-            bool erodeLeft = (x == gridSize-1 || row[x+1] == 0.f);
-            if (erodeRight && erodeLeft) {
-                heightMap[y][x] = 0.f;
-            } else if (erodeRight) {
-                if (x<gridSize-1) heightMap[y][x+1] += row[x] * factor;
-                heightMap[y][x] = 0.f;
-            } else if (erodeLeft) {
-                if (x>0) heightMap[y][x-1] += row[x] * factor;
-                heightMap[y][x] = 0.f;
+    PROFILE_SCOPE(stepProfile, Profiler::ERODE);
+    for (int ty=0; ty<wetTiles.rows(); ++ty) {
+        int tx0, tx1;
+        if (!wetTiles.rowSpan(ty, tx0, tx1)) continue;
+        int x0 = wetTiles.cellBegin(tx0), x1 = wetTiles.cellEnd(tx1-1);
+        for (int y=wetTiles.cellBegin(ty); y<wetTiles.cellEnd(ty); ++y) {
+            // erode from a copy of the row so spills don't cascade
+            vector<float>& row = erodeRow;
+            row.resize(gridSize);
+            copy(heightMap[y] + max(0, x0-1),
+                    heightMap[y] + min(gridSize, x1+1),
+                    row.begin() + max(0, x0-1));
+            for (int tx=tx0; tx<tx1; ++tx) {
+                if (!wetTiles.test(ty, tx)) continue;
+                for (int x=wetTiles.cellBegin(tx); x<wetTiles.cellEnd(tx); ++x) {
+                    if (idMap[y][x] != -1) continue;
+                    if (row[x] == 0.f) continue;
+                    bool erodeRight = (x == 0 || row[x-1] == 0.f);
+                    bool erodeLeft = (x == gridSize-1 || row[x+1] == 0.f);
+                    if (erodeRight && erodeLeft) {
+                        heightMap[y][x] = 0.f;
+                    } else if (erodeRight) {
+                        if (x<gridSize-1) {
+                            heightMap[y][x+1] += row[x] * factor;
+                            wetTiles.mark(y, x+1);
+                        }
+                        heightMap[y][x] = 0.f;
+                    } else if (erodeLeft) {
+                        if (x>0) {
+                            heightMap[y][x-1] += row[x] * factor;
+                            wetTiles.mark(y, x-1);
+                        }
+                        heightMap[y][x] = 0.f;
+                    }
+                }
             }
-
         }
     }
 }
 
 void WindowSystem::debugIdMap() {
-    cout << "Height: " << idMap.size() << endl;
-    cout << "Width: " << idMap[0].size() << endl;
+    cout << "Height: " << idMap.height() << endl;
+    cout << "Width: " << idMap.width() << endl;
 
-    for (int y=idMap.size()-1; y >= 0; --y) {
-        for (int cell : idMap[y]) {
+    for (int y=idMap.height()-1; y >= 0; --y) {
+        for (int x=0; x<idMap.width(); ++x) {
+            int cell = idMap[y][x];
             if (cell == -1) {
                 cout << "- ";
             } else {
@@ -427,24 +801,24 @@ void WindowSystem::debugIdMap() {
 }
 
 void WindowSystem::debugHeightMap() {
-    cout << "Height: " << heightMap.size() << endl;
-    cout << "Width: " << heightMap[0].size() << endl;
+    cout << "Height: " << heightMap.height() << endl;
+    cout << "Width: " << heightMap.width() << endl;
 
-    for (int y=heightMap.size()-1; y >= 0; --y) {
-        for (float cell : heightMap[y]) {
-            cout << (int)ceil(cell) << " ";
+    for (int y=heightMap.height()-1; y >= 0; --y) {
+        for (int x=0; x<heightMap.width(); ++x) {
+            cout << (int)ceil(heightMap[y][x]) << " ";
         }
         cout << endl;
     }
 }
 
 void WindowSystem::debugAffinityMap() {
-    cout << "Height: " << affinityMap.size() << endl;
-    cout << "Width: " << affinityMap[0].size() << endl;
+    cout << "Height: " << affinity.size() << endl;
+    cout << "Width: " << affinity.size() << endl;
 
-    for (int y=affinityMap.size()-1; y >= 0; --y) {
-        for (float cell : affinityMap[y]) {
-            cout << cell << " ";
+    for (int y=affinity.size()-1; y >= 0; --y) {
+        for (int x=0; x<affinity.size(); ++x) {
+            cout << affinity.value(y, x) << " ";
         }
         cout << endl;
     }
@@ -452,22 +826,26 @@ void WindowSystem::debugAffinityMap() {
 
 void WindowSystem::debugDroplets() {
     cout << "###Droplets Debug###" << endl << endl;
-    for (const auto& it : droplets) {
-        int i = it.first;
+    for (int i=0; i<droplets.size(); ++i) {
+        cout << "\tDroplet " << droplets.handle[i] << " with mass " << droplets.mass[i] << endl;
         cout << "\t";
-        droplets[i]->print();
+        droplets.shape[i].print(granularity);
         cout << "\t";
-        posState[i].print();
+        droplets.pos[i].print();
         cout << "\t";
-        velState[i].print();
+        droplets.vel[i].print();
         cout << endl;
     }
 }
 
 Vector3f WindowSystem::computeNormal(int y, int x) {
+    return computeNormal(heightMap.view(), y, x);
+}
+
+Vector3f WindowSystem::computeNormal(const GridView<const float>& heights, int y, int x) const {
     float heightDiff[2] = {
-        heightMap[y][min(x+1,gridSize-1)] - heightMap[y][max(x-1,0)],
-        heightMap[min(y+1,gridSize-1)][x] - heightMap[max(y-1,0)][x]
+        heights[y][min(x+1,gridSize-1)] - heights[y][max(x-1,0)],
+        heights[min(y+1,gridSize-1)][x] - heights[max(y-1,0)][x]
     };
     Vector3f a = Vector3f(granularity*2, 0.f, heightDiff[0]);
     Vector3f b = Vector3f(0.f, granularity*2, heightDiff[1]);
@@ -476,20 +854,25 @@ Vector3f WindowSystem::computeNormal(int y, int x) {
 }
 
 
+#ifndef HEADLESS
 void WindowSystem::draw(GLProgram& gl) {
+    draw(gl, heightMap.view());
+}
+
+// heights may be a snapshot published by the simulation thread
+void WindowSystem::draw(GLProgram& gl, const GridView<const float>& heights) {
     const Vector3f DROPLET_COLOR(0.7f, 0.7f, 0.7f);
     gl.updateMaterial(DROPLET_COLOR);
     //gl.updateModelMatrix(Matrix4f::translation(origin));
 
     //VertexRecorder rec;
-    //for (const auto& it : droplets) {
-    //    int i = it.first;
-    //    Droplet * d = droplets[i];
-    //    Vector3f center = posState[i];
-    //    vector<Vector3f> offsetChain = d->getOffsetChain();
-    //    for (int sd_i=0; sd_i<(int)offsetChain.size(); ++sd_i) {
-    //        float r = d->radius(d->mass * d->getDist()[sd_i]);
-    //        center += offsetChain[sd_i];
+    //for (int i=0; i<droplets.size(); ++i) {
+    //    Droplet& d = droplets.shape[i];
+    //    Vector3f center = droplets.pos[i];
+    //    Span<const uint8_t> chain = d.offsetChain();
+    //    for (int sd_i=0; sd_i<chain.size; ++sd_i) {
+    //        float r = Droplet::radius(droplets.mass[i] * d.dists()[sd_i]);
+    //        center += Droplet::offset(chain[sd_i], granularity);
     //        gl.updateModelMatrix(Matrix4f::translation(origin+center-Vector3f::FORWARD));
     //        drawSphere(r, 10, 10);
     //    }
@@ -501,19 +884,19 @@ void WindowSystem::draw(GLProgram& gl) {
     for (int y=1; y < gridSize; ++y) {
         for (int x=1; x < gridSize; ++x) {
 
-            Vector3f d = getGridPos(vector<int>({y,x})) - Vector3f::FORWARD*heightMap[y][x];
-            Vector3f c = getGridPos(vector<int>({y,x-1})) - Vector3f::FORWARD*heightMap[y][x-1];
-            Vector3f b = getGridPos(vector<int>({y-1,x})) - Vector3f::FORWARD*heightMap[y-1][x];
-            Vector3f a = getGridPos(vector<int>({y-1,x-1})) - Vector3f::FORWARD*heightMap[y-1][x-1];
-            rec2.record(d, computeNormal(y,x));
-            rec2.record(b, computeNormal(y-1,x));
-            rec2.record(a, computeNormal(y-1,x-1));
-
-            rec2.record(d, computeNormal(y,x));
-            rec2.record(a, computeNormal(y-1,x-1));
-            rec2.record(c, computeNormal(y,x-1));
+            Vector3f d = getGridPos(vector<int>({y,x})) - Vector3f::FORWARD*heights[y][x];
+            Vector3f c = getGridPos(vector<int>({y,x-1})) - Vector3f::FORWARD*heights[y][x-1];
+            Vector3f b = getGridPos(vector<int>({y-1,x})) - Vector3f::FORWARD*heights[y-1][x];
+            Vector3f a = getGridPos(vector<int>({y-1,x-1})) - Vector3f::FORWARD*heights[y-1][x-1];
+            rec2.record(d, computeNormal(heights, y,x));
+            rec2.record(b, computeNormal(heights, y-1,x));
+            rec2.record(a, computeNormal(heights, y-1,x-1));
+
+            rec2.record(d, computeNormal(heights, y,x));
+            rec2.record(a, computeNormal(heights, y-1,x-1));
+            rec2.record(c, computeNormal(heights, y,x-1));
         }
     }
     rec2.draw();
 }
-
+#endif
@@ -1,13 +1,26 @@
 #ifndef WINDOWSYSTEM_H
 #define WINDOWSYSTEM_H
 
-#include <map>
-#include <set>
+#include <memory>
+#include <utility>
 #include <vector>
 #include <vecmath.h>
 
+#include "affinityfield.h"
+#include "boxblur.h"
+#include "disjointset.h"
 #include "droplet.h"
+#include "dropletstore.h"
+#include "exporter.h"
+#include "exportpolicy.h"
+#include "grid2d.h"
 #include "particlesystem.h"
+#include "profiler.h"
+#include "random.h"
+#include "rasterizer.h"
+#include "summedarea.h"
+#include "threadpool.h"
+#include "tilemask.h"
 #include "Image.h"
 
 using namespace std;
@@ -24,25 +37,65 @@ public:
             );
     ~WindowSystem() {};
 
+    // Configuration
+    void setThreadCount(int threads);   // 0 = one per hardware thread
+    void setExportQueue(int encoders, int slots,
+            HeightMapExporter::Backpressure policy);
+    // opens the sequence file of a SEQUENCE policy; throws if it cannot
+    void setExportPolicy(const ExportPolicy& policy);
+    // waits for queued frames to be written (and a sequence to be readable)
+    void flushExports();
+    void setSubstepLimit(float cellFraction);   // CFLStepper substep length, in cells
+    void setSleeping(bool enabled);     // let still droplets sleep (default on)
+    void setLookAhead(int cells);       // side of the evalAccel tug windows (default 3)
+    // how evalAccel sums its windows: summed-area tables when they are the
+    // cheaper way (AUTO_SUMS, default), or always one way. Both give the
+    // same directions, so this only changes the cost
+    enum WindowSums { AUTO_SUMS, DIRECT_SUMS, TABLE_SUMS };
+    void setWindowSums(WindowSums sums);
+    // replays a run: call before the first step and before setAffinity,
+    // as it regenerates the default affinity (default seed is the time)
+    void setSeed(uint64_t seed);
+    const HeightMapExporter& exportQueue() const { return *exporter; }
+    Profiler& profiler() { return stepProfile; }   // off until enabled
 
     // Static Constants
     static const float G_NORM;
     static const Vector3f G_DIR;
+    static const float SLEEP_DRIFT;     // cells per step still counted as still
+    static const int SLEEP_STEPS;       // still steps before a droplet sleeps
+    static const float MASS_TOLERANCE;  // window masses this close (relative) tie
 
     // Helper Observers
+    int dropletCount() const;
+    int gridCells() const { return gridSize; }  // cells per side
+    uint64_t seed() const { return rngSeed; }
+    int sleepingCount() const;
+    bool tableWindows() const { return useTables; } // next step sums windows from tables
+    void copyHeightMap(Grid2D<float>& out) const;
+    void copyIdMap(Grid2D<int>& out) const;
     vector<int> getGridIdx(Vector3f pos);
     Vector3f getGridPos(vector<int> idx);
 
     vector<int> clipIdx(vector<int> idx);
-    map<int, Vector3f> evalAccel() override;
+    // acceleration of droplet slot i if it were at pos moving at vel
+    Vector3f evalAccel(int i, const Vector3f& pos, const Vector3f& vel) override;
+
+    // State Vector
+    void getState(vector<Vector3f>& state) const override;
+    void setState(const vector<Vector3f>& state) override;
+    void evalF(const vector<Vector3f>& state, vector<Vector3f>& f) override;
+    float maxDisplacement() const override;
+    void sweep(int i, const Vector3f& from, const Vector3f& to) override;
 
     // State Mutators
     void resetIdMap();
     void resetHeightMap();
-    void resetAffinityMap();
-    void addDroplet(float mass, Vector3f pos, Vector3f vel);
-    void takeStep(float stepSize) override;
-    void blurHeightMap(float epsilon=0.01f);
+    void resetAffinityMap();            // white noise from the affinity stream
+    void setAffinity(const AffinityField& field);   // must be gridSize wide
+    int addDroplet(float mass, Vector3f pos, Vector3f vel);
+    void postStep(float stepSize) override;
+    void blurHeightMap(float epsilon=0.01f, int radius=1);
     void erodeHeightMap(float factor=0.5f);
 
     // Debug Helpers
@@ -51,15 +104,13 @@ public:
     void debugAffinityMap();
     void debugDroplets();
 
-    // OpenGL function
+    // OpenGL function (draw is not built into the headless target)
     Vector3f computeNormal(int y, int x);
+    Vector3f computeNormal(const GridView<const float>& heights, int y, int x) const;
     void draw(GLProgram& ctx);
+    void draw(GLProgram& ctx, const GridView<const float>& heights);
 
 protected:
-    // inherits
-    // vector<Vector3f> posState;
-    // vector<Vector3f> velState;
-
     // OpenGL related vars
     Vector3f origin;
 
@@ -68,19 +119,92 @@ protected:
     float granularity;              // width of a grid cell
     int gridSize;                   // number of cells in a row
 
-    // TODO: Change rep to Image classes
-    vector<vector<int>> idMap;
-    vector<vector<float>> heightMap;
-    vector<vector<float>> affinityMap;
+    Grid2D<int> idMap;
+    Grid2D<float> heightMap;
+    AffinityField affinity;         // prepared for lookAhead
+
+    // Active Regions
+    TileMask idTiles;               // tiles where idMap may be set
+    TileMask wetTiles;              // tiles where heightMap may be non-zero
+    TileMask blurTiles;             // wetTiles grown by the blur footprint
+    BoxBlur blur;
+    vector<float> erodeRow;         // scratch row for erodeHeightMap
 
     // Droplet Represenation
     float raininess;                // probability of a droplet appearing on the grid
     vector<float> dropletSize;      // range of masses droplet can have
 
-    map<int, Droplet *> droplets;
-    int maxDropletIdx;
-
-    int frameNo;
+    DropletStore droplets;
+
+    // Rasterization
+    unique_ptr<ThreadPool> pool;
+    Rasterizer rasterizer;
+    vector<pair<int, int>> overlaps; // (slot, slot) overlaps from rasterizing
+
+    // Merge Detection
+    DisjointSet mergeSets;          // droplets to merge this step, by slot
+    vector<int> mergeMembers;       // scratch for resolving merged blobs
+    vector<int> mergeOffsets;
+    float substepLimit;             // cells a droplet may cross per substep
+    vector<pair<int, int>> sweptMerges; // (handle, handle) hits from sweep
+
+    // Neighbourhood Queries
+    void buildQueryTables();        // after the maps change, before evalAccel
+
+    int lookAhead;                  // side of the tug windows, in cells
+    WindowSums windowSums;
+    bool useTables;                 // this step's windows are summed from the tables
+    SummedAreaTable heightSums;     // wet part of heightMap
+    vector<SummedAreaTable> ownSums;    // per slot, heights of its own idMap cells
+
+    // Step Phases (postStep, in order)
+    void spawnDroplets();
+    void splitDroplets(float stepSize);
+    void cullDroplets();
+    void rasterizeDroplets();       // also unites the overlapping droplets
+    void scanMerges();
+    void resolveMerges();           // also compacts the store
+
+    // Sleeping
+    void updateSleep(float stepSize);
+    // whether a tug window of droplet slot i overlaps a flagged tile
+    bool windowsTouch(int i, const TileMask& tiles) const;
+
+    bool sleeping;
+    TileMask eventTiles;            // tiles touched by this step's merges
+    TileMask sleepWetTiles;         // wetTiles at the last updateSleep
+    TileMask wetChanges;            // tiles that got wet or dry since then
+
+    // Randomness
+    // streams under rngSeed; droplet h draws from stream DROPLET_STREAMS + h
+    enum { WORLD_STREAM = 0, AFFINITY_STREAM = 1, DROPLET_STREAMS = 2 };
+    // draws a droplet makes per step, by use
+    enum { TUG_DRAW = 0, SPLIT_DRAW = 1, SPLIT_MASS_DRAW = 2, DRAWS_PER_STEP = 3 };
+    float dropletDraw(int h, int draw, float low, float hi) const;
+
+    uint64_t rngSeed;
+    Random rng;                     // world stream: rain and droplet shapes
+
+    // Export
+    bool exportDue();
+    void appendSequenceFrame();
+
+    int frameNo;                    // simulation steps taken
+    double simTime;                 // simulated seconds
+    ExportPolicy exportPolicy;
+    double nextExportTime;          // next frame boundary when exporting by fps
+    int exportFrame;                // frames exported so far
+    unique_ptr<HeightSequenceWriter> sequence;  // open for a SEQUENCE policy
+    TileMask changedTiles;          // tiles wet at the last frame or since
+    Grid2D<float> exportedHeights;  // the last TILE_DELTA frame, deltas' baseline
+    vector<unsigned char> deltaFrame;   // packed for the export queue
+    int deltaFrames;                // TILE_DELTA frames since the keyframe
+    bool keyFrameDue;               // the next frame cannot be a delta
+    unique_ptr<HeightMapExporter> exporter;     // after sequence: drains first
+    friend struct SequenceTestHook;             // reaches exporter to pause it
+
+    // Profiling
+    Profiler stepProfile;
 };
 
 
@@ -0,0 +1,406 @@
+// Golden-output regression test: runs small seeded scenarios and checks
+// every step's heightMap and idMap against data recorded in tests/golden.
+//
+// Per step the golden files hold a hash of the exact heightMap and idMap
+// bits and the height sum of every 32 x 32 tile; every CHECKPOINT_EVERY
+// steps they also hold the whole heightMap. By default the hashes must
+// match, i.e. the output is bit for bit unchanged. With -e <eps> the
+// tile sums and checkpoint heights need only agree to within eps (and
+// ids are not compared), for changes that only reorder float arithmetic.
+//
+// Scenarios that exercise the summed-area tables are also run with
+// evalAccel forced onto the direct sums and onto the tables, and must
+// match the same data: both ways must pick the same tug directions.
+//
+// On a mismatch the first divergent step is reported, and a diff image
+// of the first checkpoint from there on is written (red where heights
+// grew, green where they shrank). -u rewrites the golden files.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "Image.h"
+#include "affinityfield.h"
+#include "lodepng.h"
+#include "timestepper.h"
+#include "windowsystem.h"
+
+using namespace std;
+
+namespace
+{
+
+const char MAGIC[8] = { 'R', 'A', 'I', 'N', 'G', 'L', 'D', '1' };
+const int TILE = 32;
+const int CHECKPOINT_EVERY = 25;
+
+struct Scenario {
+    const char* name;
+    float size;                     // window side; cells = size / granularity
+    float granularity;
+    float raininess;
+    float massLo, massHi;
+    char integrator;
+    int threads;
+    unsigned noiseSeed;             // noise affinity, 0 = the default white noise
+    int lookAhead;                  // tug window side
+    bool tables;                    // must sum its windows from the tables on some step,
+                                    // and match with them forced on and off
+    int steps;
+};
+
+const Scenario SCENARIOS[] = {
+    // name       size   gran   rain  masses      integ threads noise look tables steps
+    { "rain_rk4",  1.25f, 0.01f, 0.3f, 0.f, 1.2f,  'r', 1,      0,    3,   false, 150 },
+    { "storm_cfl", 1.25f, 0.01f, 0.8f, 0.5f, 2.f,  'c', 3,      0,    3,   false, 150 },
+    { "noise_rk45",1.25f, 0.01f, 0.2f, 0.f, 1.2f,  'a', 2,      7,    3,   false, 150 },
+    // wide windows, so evalAccel takes the summed-area table path
+    { "wide_tables",1.25f, 0.01f, 0.8f, 0.f, 1.2f, 'r', 2,      0,    9,   true,  150 },
+};
+const int SCENARIO_COUNT = sizeof(SCENARIOS) / sizeof(SCENARIOS[0]);
+const uint64_t SEED = 20171213;
+
+// what a step leaves behind
+struct StepRecord {
+    uint64_t heightHash;
+    uint64_t idHash;
+    vector<double> tileSums;
+};
+
+struct Golden {
+    int cells;
+    int steps;
+    vector<StepRecord> records;
+    vector<vector<float>> checkpoints;  // heights of steps CHECKPOINT_EVERY, 2*CHECKPOINT_EVERY...
+};
+
+uint64_t fnv1a(uint64_t h, const void* data, size_t bytes) {
+    const unsigned char* p = (const unsigned char*)data;
+    for (size_t i=0; i<bytes; ++i) {
+        h ^= p[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+StepRecord record(const Grid2D<float>& heights, const Grid2D<int>& ids) {
+    int n = heights.width();
+    int tiles = (n + TILE - 1) / TILE;
+    StepRecord r;
+    r.heightHash = r.idHash = 14695981039346656037ULL;
+    r.tileSums.assign(tiles * tiles, 0.0);
+    for (int y=0; y<n; ++y) {
+        r.heightHash = fnv1a(r.heightHash, heights[y], n * sizeof(float));
+        r.idHash = fnv1a(r.idHash, ids[y], n * sizeof(int));
+        for (int x=0; x<n; ++x) {
+            r.tileSums[(y / TILE) * tiles + x / TILE] += heights[y][x];
+        }
+    }
+    return r;
+}
+
+vector<float> flatten(const Grid2D<float>& heights) {
+    int n = heights.width();
+    vector<float> out(n * n);
+    for (int y=0; y<n; ++y) {
+        copy(heights[y], heights[y] + n, &out[y * n]);
+    }
+    return out;
+}
+
+bool writeGolden(const string& filename, const Golden& g) {
+    FILE* out = fopen(filename.c_str(), "wb");
+    if (!out) return false;
+    fwrite(MAGIC, 1, sizeof(MAGIC), out);
+    fwrite(&g.cells, sizeof(int), 1, out);
+    fwrite(&g.steps, sizeof(int), 1, out);
+    for (const StepRecord& r : g.records) {
+        fwrite(&r.heightHash, sizeof(uint64_t), 1, out);
+        fwrite(&r.idHash, sizeof(uint64_t), 1, out);
+        fwrite(r.tileSums.data(), sizeof(double), r.tileSums.size(), out);
+    }
+    for (const vector<float>& frame : g.checkpoints) {
+        // mostly dry, so deflate shrinks it a lot
+        unsigned char* packed = nullptr;
+        size_t packedSize = 0;
+        lodepng_zlib_compress(&packed, &packedSize, (const unsigned char*)frame.data(),
+                frame.size() * sizeof(float), &lodepng_default_compress_settings);
+        uint32_t bytes = (uint32_t)packedSize;
+        fwrite(&bytes, sizeof(uint32_t), 1, out);
+        fwrite(packed, 1, packedSize, out);
+        free(packed);
+    }
+    return fclose(out) == 0;
+}
+
+bool readGolden(const string& filename, Golden& g) {
+    FILE* in = fopen(filename.c_str(), "rb");
+    if (!in) return false;
+    char magic[sizeof(MAGIC)];
+    bool ok = fread(magic, 1, sizeof(magic), in) == sizeof(magic) &&
+            memcmp(magic, MAGIC, sizeof(MAGIC)) == 0 &&
+            fread(&g.cells, sizeof(int), 1, in) == 1 &&
+            fread(&g.steps, sizeof(int), 1, in) == 1 &&
+            g.cells > 0 && g.steps > 0;
+    int tiles = ok ? (g.cells + TILE - 1) / TILE : 0;
+    g.records.resize(ok ? g.steps : 0);
+    for (StepRecord& r : g.records) {
+        r.tileSums.resize(tiles * tiles);
+        ok = ok && fread(&r.heightHash, sizeof(uint64_t), 1, in) == 1 &&
+                fread(&r.idHash, sizeof(uint64_t), 1, in) == 1 &&
+                fread(r.tileSums.data(), sizeof(double), r.tileSums.size(), in) == r.tileSums.size();
+    }
+    g.checkpoints.resize(ok ? g.steps / CHECKPOINT_EVERY : 0);
+    for (vector<float>& frame : g.checkpoints) {
+        uint32_t bytes = 0;
+        ok = ok && fread(&bytes, sizeof(uint32_t), 1, in) == 1;
+        vector<unsigned char> packed(ok ? bytes : 0);
+        ok = ok && fread(packed.data(), 1, bytes, in) == bytes;
+        unsigned char* raw = nullptr;
+        size_t rawSize = 0;
+        ok = ok && lodepng_zlib_decompress(&raw, &rawSize, packed.data(), packed.size(),
+                &lodepng_default_decompress_settings) == 0 &&
+                rawSize == (size_t)g.cells * g.cells * sizeof(float);
+        if (ok) {
+            frame.resize(g.cells * g.cells);
+            memcpy(frame.data(), raw, rawSize);
+        }
+        free(raw);
+    }
+    fclose(in);
+    return ok;
+}
+
+void writeDiff(const string& filename, const vector<float>& golden,
+        const Grid2D<float>& heights, float& maxDiff) {
+    int n = heights.width();
+    Image diff(n, n, 3);
+    maxDiff = 0.f;
+    for (int y=0; y<n; ++y) {
+        for (int x=0; x<n; ++x) {
+            maxDiff = max(maxDiff, fabs(heights[y][x] - golden[y * n + x]));
+        }
+    }
+    float scale = maxDiff > 0.f ? 1.f / maxDiff : 0.f;
+    for (int y=0; y<n; ++y) {
+        for (int x=0; x<n; ++x) {
+            // row 0 at the bottom, as the exported heightmaps
+            float d = (heights[y][x] - golden[y * n + x]) * scale;
+            diff(x, n-1-y, 0) = max(0.f, d);
+            diff(x, n-1-y, 1) = max(0.f, -d);
+            diff(x, n-1-y, 2) = golden[y * n + x] > 0.f ? 0.2f : 0.f;
+        }
+    }
+    diff.write(filename);
+}
+
+TimeStepper* makeStepper(char integrator) {
+    switch (integrator) {
+    case 'e': return new ForwardEuler();
+    case 's': return new SemiImplicitEuler();
+    case 'm': return new Midpoint();
+    case 'r': return new RK4();
+    case 'a': return new RK45();
+    case 'c': return new CFLStepper();
+    default: return nullptr;
+    }
+}
+
+// true when the scenario, with its windows summed as sums asks, matches
+// its golden data (or it was rewritten)
+bool run(const Scenario& sc, WindowSystem::WindowSums sums, const string& dir, bool update,
+        double eps, const string& diffDir) {
+    string goldenFile = dir + "/" + sc.name + ".gold";
+    string label = sc.name;
+    if (sums == WindowSystem::DIRECT_SUMS) label += "+direct";
+    if (sums == WindowSystem::TABLE_SUMS) label += "+tables";
+    Golden golden;
+    if (!update && !readGolden(goldenFile, golden)) {
+        printf("%-12s FAIL: cannot read %s (run with -u to record it)\n", label.c_str(), goldenFile.c_str());
+        return false;
+    }
+
+    WindowSystem system(Vector3f(-sc.size / 2, -sc.size / 2, 0.f), sc.size, sc.granularity,
+            sc.raininess, vector<float>({sc.massLo, sc.massHi}));
+    system.setSeed(SEED);
+    system.setThreadCount(sc.threads);
+    system.setLookAhead(sc.lookAhead);
+    system.setWindowSums(sums);
+    if (sc.noiseSeed) {
+        AffinityField field;
+        field.noise(system.gridCells(), sc.noiseSeed, 4.f, 12.f);
+        system.setAffinity(field);
+    }
+    ExportPolicy policy;
+    policy.sink = ExportPolicy::NONE;
+    policy.verbose = false;
+    system.setExportPolicy(policy);
+    TimeStepper* stepper = makeStepper(sc.integrator);
+
+    if (!update && (golden.cells != system.gridCells() || golden.steps != sc.steps)) {
+        printf("%-12s FAIL: golden data is for %d cells x %d steps, scenario is %d x %d\n",
+                label.c_str(), golden.cells, golden.steps, system.gridCells(), sc.steps);
+        delete stepper;
+        return false;
+    }
+
+    Grid2D<float> heights;
+    Grid2D<int> ids;
+    Golden fresh;
+    fresh.cells = system.gridCells();
+    fresh.steps = sc.steps;
+    int divergedAt = 0;             // first divergent step, 1-based
+    int tableSteps = 0;             // steps that summed their windows from the tables
+    string why;
+
+    for (int step=1; step<=sc.steps; ++step) {
+        if (system.tableWindows()) ++tableSteps;
+        stepper->takeStep(&system, 0.01f);
+        system.copyHeightMap(heights);
+        system.copyIdMap(ids);
+        StepRecord r = record(heights, ids);
+        bool checkpoint = step % CHECKPOINT_EVERY == 0;
+
+        if (update) {
+            fresh.records.push_back(r);
+            if (checkpoint) fresh.checkpoints.push_back(flatten(heights));
+            continue;
+        }
+
+        const StepRecord& g = golden.records[step-1];
+        if (!divergedAt) {
+            char buf[160];
+            if (eps <= 0.0) {
+                if (r.heightHash != g.heightHash) why = "heightMap bits differ";
+                else if (r.idHash != g.idHash) why = "idMap differs";
+            } else {
+                for (size_t t=0; t<r.tileSums.size() && why.empty(); ++t) {
+                    if (fabs(r.tileSums[t] - g.tileSums[t]) > eps * (1.0 + fabs(g.tileSums[t]))) {
+                        snprintf(buf, sizeof(buf), "tile %zu sums to %.9g, golden %.9g",
+                                t, r.tileSums[t], g.tileSums[t]);
+                        why = buf;
+                    }
+                }
+                if (why.empty() && checkpoint) {
+                    const vector<float>& frame = golden.checkpoints[step / CHECKPOINT_EVERY - 1];
+                    int n = fresh.cells;
+                    for (int k=0; k<n*n && why.empty(); ++k) {
+                        if (fabs(heights[k / n][k % n] - frame[k]) > eps) {
+                            snprintf(buf, sizeof(buf), "cell (%d, %d) is %.9g, golden %.9g",
+                                    k / n, k % n, heights[k / n][k % n], frame[k]);
+                            why = buf;
+                        }
+                    }
+                }
+            }
+            if (!why.empty()) divergedAt = step;
+        }
+        if (divergedAt && checkpoint) {
+            // the first checkpoint at or after the divergence shows it
+            float maxDiff;
+            string diffFile = diffDir + "/" + label + "_diff.png";
+            writeDiff(diffFile, golden.checkpoints[step / CHECKPOINT_EVERY - 1], heights, maxDiff);
+            printf("%-12s FAIL: step %d diverges (%s); at step %d heights differ by up to %g, see %s\n",
+                    label.c_str(), divergedAt, why.c_str(), step, maxDiff, diffFile.c_str());
+            break;
+        }
+    }
+    delete stepper;
+
+    bool noTables = sc.tables && sums == WindowSystem::AUTO_SUMS && tableSteps == 0;
+    if (update) {
+        if (noTables) {
+            printf("%-12s FAIL: never summed its windows from the tables\n", label.c_str());
+            return false;
+        }
+        if (!writeGolden(goldenFile, fresh)) {
+            printf("%-12s FAIL: cannot write %s\n", label.c_str(), goldenFile.c_str());
+            return false;
+        }
+        printf("%-12s recorded %d steps to %s\n", label.c_str(), sc.steps, goldenFile.c_str());
+        return true;
+    }
+    if (divergedAt) {
+        if (divergedAt > sc.steps - sc.steps % CHECKPOINT_EVERY) {
+            printf("%-12s FAIL: step %d diverges (%s)\n", label.c_str(), divergedAt, why.c_str());
+        }
+        return false;
+    }
+    if (noTables) {
+        printf("%-12s FAIL: never summed its windows from the tables\n", label.c_str());
+        return false;
+    }
+    if (sc.tables && sums == WindowSystem::AUTO_SUMS) {
+        printf("%-12s ok (%d steps, %d summed from the tables)\n", label.c_str(), sc.steps, tableSteps);
+    } else {
+        printf("%-12s ok (%d steps)\n", label.c_str(), sc.steps);
+    }
+    return true;
+}
+
+void usage(const char* prog)
+{
+    printf("Usage: %s [options] [scenario ...]\n", prog);
+    printf("       -d <dir>        golden data directory (default tests/golden)\n");
+    printf("       -u              record the golden data instead of checking it\n");
+    printf("       -e <eps>        compare heights to within eps instead of bit for bit\n");
+    printf("       -o <dir>        where diff images go (default .)\n");
+    printf("\n");
+    printf("Scenarios:");
+    for (int k=0; k<SCENARIO_COUNT; ++k) printf(" %s", SCENARIOS[k].name);
+    printf(" (default all)\n");
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    string dir = "tests/golden";
+    string diffDir = ".";
+    bool update = false;
+    double eps = 0.0;
+    vector<const Scenario*> selected;
+
+    for (int i=1; i<argc; ++i) {
+        const char* flag = argv[i];
+        bool hasValue = i+1 < argc;
+        if (!strcmp(flag, "-d") && hasValue) dir = argv[++i];
+        else if (!strcmp(flag, "-u")) update = true;
+        else if (!strcmp(flag, "-e") && hasValue) eps = atof(argv[++i]);
+        else if (!strcmp(flag, "-o") && hasValue) diffDir = argv[++i];
+        else {
+            const Scenario* found = nullptr;
+            for (int k=0; k<SCENARIO_COUNT; ++k) {
+                if (!strcmp(flag, SCENARIOS[k].name)) found = &SCENARIOS[k];
+            }
+            if (!found) {
+                usage(argv[0]);
+                return 2;
+            }
+            selected.push_back(found);
+        }
+    }
+    if (selected.empty()) {
+        for (int k=0; k<SCENARIO_COUNT; ++k) selected.push_back(&SCENARIOS[k]);
+    }
+
+    int failed = 0;
+    for (const Scenario* sc : selected) {
+        if (!run(*sc, WindowSystem::AUTO_SUMS, dir, update, eps, diffDir)) ++failed;
+        if (sc->tables && !update) {
+            // either way of summing the windows must pick the same directions
+            if (!run(*sc, WindowSystem::DIRECT_SUMS, dir, update, eps, diffDir)) ++failed;
+            if (!run(*sc, WindowSystem::TABLE_SUMS, dir, update, eps, diffDir)) ++failed;
+        }
+    }
+    if (failed) {
+        printf("%d scenario runs failed\n", failed);
+    }
+    return failed ? 1 : 0;
+}
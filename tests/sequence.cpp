@@ -0,0 +1,228 @@
+// Sequence file round trip test: runs a small seeded scenario once per
+// encoding with every frame appended to a sequence file, then reads the
+// file back and checks every frame against the heightMap it was taken
+// from.
+//
+// Frames are read once in order (each from the one before, as a player
+// would) and once in a shuffled order, each on its own through the index.
+// The lossless encodings must give the heights back bit for bit; FLOAT16
+// must give them back as rounded by HeightSequence::floatToHalf.
+//
+// A case can force a frame to be dropped: the export queue is then one
+// slot that drops when full, held paused over the step before, so that
+// step's frame fills it. A TILE_DELTA sequence must carry on with a
+// keyframe, since the next delta would be against a frame never written.
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "exporter.h"
+#include "exportpolicy.h"
+#include "heightsequence.h"
+#include "timestepper.h"
+#include "windowsystem.h"
+
+using namespace std;
+
+// the export queue's pause, which only this test may use
+struct SequenceTestHook {
+    static void setPaused(WindowSystem& system, bool paused) {
+        system.exporter->setPaused(paused);
+    }
+};
+
+namespace
+{
+
+struct Case {
+    const char* name;
+    HeightSequence::Encoding encoding;
+    int keyEvery;                   // TILE_DELTA frames per keyframe
+    int dropAt;                     // step whose frame is dropped, 0 = none
+};
+
+const Case CASES[] = {
+    // name         encoding                    key  drop
+    { "float32",    HeightSequence::FLOAT32,    0,   0 },
+    { "float16",    HeightSequence::FLOAT16,    0,   0 },
+    { "delta_lz",   HeightSequence::DELTA_LZ,   0,   0 },
+    { "tile_delta", HeightSequence::TILE_DELTA, 10,  0 },
+    { "tile_drop",  HeightSequence::TILE_DELTA, 10,  23 },
+};
+const int CASE_COUNT = sizeof(CASES) / sizeof(CASES[0]);
+const uint64_t SEED = 20171213;
+const int STEPS = 60;
+const float STEP_SIZE = 0.01f;
+
+// what a frame should decode to
+struct Frame {
+    Grid2D<float> heights;
+    double time;
+};
+
+float stored(float h, HeightSequence::Encoding encoding) {
+    if (encoding != HeightSequence::FLOAT16) return h;
+    return HeightSequence::halfToFloat(HeightSequence::floatToHalf(h));
+}
+
+// "" if view holds frame's heights as the encoding stores them
+string compare(const GridView<const float>& view, const Frame& frame,
+        HeightSequence::Encoding encoding) {
+    const Grid2D<float>& want = frame.heights;
+    char buf[160];
+    if (view.width != want.width() || view.height != want.height()) {
+        snprintf(buf, sizeof(buf), "is %d x %d, not %d x %d",
+                view.width, view.height, want.width(), want.height());
+        return buf;
+    }
+    for (int y=0; y<want.height(); ++y) {
+        for (int x=0; x<want.width(); ++x) {
+            float w = stored(want[y][x], encoding);
+            if (memcmp(&view[y][x], &w, sizeof(float)) != 0) {
+                snprintf(buf, sizeof(buf), "cell (%d, %d) is %.9g, wrote %.9g",
+                        y, x, view[y][x], w);
+                return buf;
+            }
+        }
+    }
+    return "";
+}
+
+// true when every frame of the case's sequence reads back as written
+bool run(const Case& c, const string& dir) {
+    WindowSystem system(Vector3f(-0.625f, -0.625f, 0.f), 1.25f, 0.01f, 0.3f,
+            vector<float>({0.f, 1.2f}));
+    system.setSeed(SEED);
+    system.setThreadCount(2);
+    if (c.dropAt) {
+        system.setExportQueue(1, 1, HeightMapExporter::DROP);
+    }
+    ExportPolicy policy;
+    policy.sink = ExportPolicy::SEQUENCE;
+    policy.directory = dir;
+    policy.prefix = string("sequence_") + c.name;
+    policy.verbose = false;
+    policy.sequenceEncoding = c.encoding;
+    if (c.keyEvery) policy.keyEvery = c.keyEvery;
+    system.setExportPolicy(policy);
+    RK4 integrator;
+    TimeStepper* stepper = &integrator;
+
+    vector<Frame> frames;
+    int afterDrop = -1;             // frame written after the dropped one
+    double time = 0.0;
+    for (int step=1; step<=STEPS; ++step) {
+        if (c.dropAt && step != c.dropAt) {
+            // one frame at a time, so that only the forced drop happens;
+            // the frame of the step before it stays queued until after it
+            SequenceTestHook::setPaused(system, false);
+            system.flushExports();
+            SequenceTestHook::setPaused(system, step == c.dropAt - 1);
+        }
+        int dropped = system.exportQueue().dropped();
+        stepper->takeStep(&system, STEP_SIZE);
+        time += STEP_SIZE;
+        if (system.exportQueue().dropped() != dropped) {
+            if (step != c.dropAt) {
+                printf("%-10s FAIL: step %d's frame was dropped\n", c.name, step);
+                return false;
+            }
+            afterDrop = (int)frames.size();
+            continue;
+        }
+        frames.push_back(Frame());
+        system.copyHeightMap(frames.back().heights);
+        frames.back().time = time;
+    }
+    SequenceTestHook::setPaused(system, false);
+    system.flushExports();
+    if (c.dropAt && afterDrop < 0) {
+        printf("%-10s FAIL: step %d's frame was not dropped\n", c.name, c.dropAt);
+        return false;
+    }
+
+    HeightSequenceReader reader;
+    if (!reader.open(policy.sequenceFilename())) {
+        printf("%-10s FAIL: cannot read %s\n", c.name, policy.sequenceFilename().c_str());
+        return false;
+    }
+    if (reader.encoding() != c.encoding || reader.frames() != (int)frames.size()) {
+        printf("%-10s FAIL: holds %d %s frames, wrote %d %s\n", c.name, reader.frames(),
+                HeightSequence::encodingName(reader.encoding()), (int)frames.size(),
+                HeightSequence::encodingName(c.encoding));
+        return false;
+    }
+    if (afterDrop >= 0 && !reader.isKeyFrame(afterDrop)) {
+        printf("%-10s FAIL: frame %d after the dropped one is not a keyframe\n",
+                c.name, afterDrop+1);
+        return false;
+    }
+
+    // in order, then by random access
+    vector<int> order;
+    for (int f=0; f<(int)frames.size(); ++f) order.push_back(f);
+    vector<int> shuffled = order;
+    shuffle(shuffled.begin(), shuffled.end(), mt19937((unsigned)SEED));
+    order.insert(order.end(), shuffled.begin(), shuffled.end());
+
+    Grid2D<float> heights;
+    for (int k=0; k<(int)order.size(); ++k) {
+        int f = order[k];
+        bool inOrder = k < (int)frames.size();
+        const char* how = inOrder ? "in order" : "by random access";
+        string why;
+        if (!reader.frame(f, heights, inOrder ? f-1 : -1)) {
+            why = "does not decode";
+        } else if (reader.time(f) != frames[f].time) {
+            char buf[80];
+            snprintf(buf, sizeof(buf), "is at %.9g s, not %.9g s", reader.time(f), frames[f].time);
+            why = buf;
+        } else {
+            why = compare(heights.view(), frames[f], c.encoding);
+        }
+        if (why.empty() && c.encoding == HeightSequence::FLOAT32) {
+            why = compare(reader.view(f), frames[f], c.encoding);
+        }
+        if (!why.empty()) {
+            printf("%-10s FAIL: frame %d read %s %s\n", c.name, f+1, how, why.c_str());
+            return false;
+        }
+    }
+    printf("%-10s ok (%d frames, %zu bytes)\n", c.name, reader.frames(), reader.fileBytes());
+    return true;
+}
+
+void usage(const char* prog)
+{
+    printf("Usage: %s [options]\n", prog);
+    printf("       -o <dir>        where to write the sequence files (default .)\n");
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    string dir = ".";
+    for (int i=1; i<argc; ++i) {
+        if (!strcmp(argv[i], "-o") && i+1 < argc) dir = argv[++i];
+        else {
+            usage(argv[0]);
+            return 2;
+        }
+    }
+
+    int failed = 0;
+    for (int k=0; k<CASE_COUNT; ++k) {
+        if (!run(CASES[k], dir)) ++failed;
+    }
+    if (failed) {
+        printf("%d of %d encodings failed\n", failed, CASE_COUNT);
+        return 1;
+    }
+    return 0;
+}